@@ -0,0 +1,462 @@
+/*
+ *  **************************************************************************
+ *  Copyright 2026 Shuai Cheng Li and Yen Kaow Ng
+ *  **************************************************************************
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  **************************************************************************
+ * 
+ */
+
+
+
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <stdlib.h>
+#include <string.h>
+
+#include "BulkReader.h"
+#include "MappedFile.h"
+
+#ifdef _USE_IO_URING_
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+
+BulkReader::BulkReader(const vector<char *>& files, size_t first, size_t end)
+    : mFiles(files)
+{
+    mFirst = first;
+    mEnd = end;
+    mBytes = 0;
+    mIoUring = false;
+}
+
+
+void
+BulkReader::read(Parser parse, int numThreads)
+{
+    if (numThreads < 1)
+        numThreads = 1;
+#ifdef _USE_IO_URING_
+    if (mEnd - mFirst >= 2 && readIoUring(parse, numThreads))
+    {
+        mIoUring = true;
+        return;
+    }
+#endif
+    readMapped(parse, numThreads);
+}
+
+
+/**
+ * Each thread maps the next file not yet taken, and parses it
+ */
+void
+BulkReader::readMapped(Parser parse, int numThreads)
+{
+    mutex lock;
+    size_t next = mFirst;
+    vector<thread> threads;
+    for (int t=0; t < numThreads; t++)
+        threads.push_back(thread([&]() {
+            size_t bytes = 0;
+            for (;;)
+            {
+                size_t i;
+                {
+                    lock_guard<mutex> guard(lock);
+                    if (next == mEnd)
+                    {
+                        mBytes += bytes;
+                        return;
+                    }
+                    i = next++;
+                }
+                MappedFile input(mFiles[i]);
+                if (!input.isOpen())
+                {
+                    cerr << "Cannot find protein file " << mFiles[i] << endl;
+                    exit(0);
+                }
+                parse(i, input.mData, input.mSize);
+                bytes += input.mSize;
+            }
+        }));
+    for (size_t t=0; t < threads.size(); t++)
+        threads[t].join();
+}
+
+
+#ifdef _USE_IO_URING_
+
+//- = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - =
+// io_uring, through the system calls (without liburing)
+//- = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - =
+
+/**
+ * An io_uring of which entries are filled with sqe() and submitted with
+ * submit(), and of which the completions are taken with complete()
+ */
+class IoUring
+{
+public:
+    IoUring(unsigned entries);
+    ~IoUring();
+    bool isOpen() { return mFd >= 0; }
+    io_uring_sqe * sqe();
+    void submit(unsigned wait);
+    bool complete(__u64& data, int& res);
+
+private:
+    int mFd;
+    void * mSqRing;
+    void * mCqRing;
+    size_t mSqRingSize;
+    size_t mCqRingSize;
+    io_uring_sqe * mSqes;
+    size_t mSqesSize;
+    unsigned * mSqTail;
+    unsigned mSqMask;
+    unsigned * mSqArray;
+    unsigned mTail;       // of the entries filled so far
+    unsigned mToSubmit;
+    unsigned * mCqHead;
+    unsigned * mCqTail;
+    unsigned mCqMask;
+    io_uring_cqe * mCqes;
+};
+
+
+IoUring::IoUring(unsigned entries)
+{
+    mSqRing = mCqRing = MAP_FAILED;
+    mSqes = (io_uring_sqe *) MAP_FAILED;
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    mFd = syscall(__NR_io_uring_setup, entries, &p);
+    if (mFd < 0)
+        return;
+    // OPENAT, STATX and CLOSE came with the kernel (5.6) that has this
+    if (!(p.features & IORING_FEAT_RW_CUR_POS))
+    {
+        close(mFd);
+        mFd = -1;
+        return;
+    }
+
+    mSqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    mCqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && mCqRingSize > mSqRingSize)
+        mSqRingSize = mCqRingSize;
+    mSqRing = mmap(NULL, mSqRingSize, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_SQ_RING);
+    mCqRing = single? mSqRing:
+              mmap(NULL, mCqRingSize, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_CQ_RING);
+    mSqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    mSqes = (io_uring_sqe *) mmap(NULL, mSqesSize, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_POPULATE, mFd,
+                                  IORING_OFF_SQES);
+    if (mSqRing == MAP_FAILED || mCqRing == MAP_FAILED
+        || mSqes == (io_uring_sqe *) MAP_FAILED)
+    {
+        close(mFd); // the destructor unmaps the rest
+        mFd = -1;
+        return;
+    }
+
+    char * sq = (char *) mSqRing;
+    char * cq = (char *) mCqRing;
+    mSqTail = (unsigned *) (sq + p.sq_off.tail);
+    mSqMask = *(unsigned *) (sq + p.sq_off.ring_mask);
+    mSqArray = (unsigned *) (sq + p.sq_off.array);
+    mTail = *mSqTail;
+    mToSubmit = 0;
+    mCqHead = (unsigned *) (cq + p.cq_off.head);
+    mCqTail = (unsigned *) (cq + p.cq_off.tail);
+    mCqMask = *(unsigned *) (cq + p.cq_off.ring_mask);
+    mCqes = (io_uring_cqe *) (cq + p.cq_off.cqes);
+}
+
+
+IoUring::~IoUring()
+{
+    if (mSqes != (io_uring_sqe *) MAP_FAILED)
+        munmap(mSqes, mSqesSize);
+    if (mCqRing != MAP_FAILED && mCqRing != mSqRing)
+        munmap(mCqRing, mCqRingSize);
+    if (mSqRing != MAP_FAILED)
+        munmap(mSqRing, mSqRingSize);
+    if (mFd >= 0)
+        close(mFd);
+}
+
+
+/**
+ * The next entry to submit, cleared. The caller submits no more entries
+ * at a time than the ring was set up for.
+ */
+io_uring_sqe *
+IoUring::sqe()
+{
+    unsigned index = mTail & mSqMask;
+    mSqArray[index] = index;
+    mTail++;
+    mToSubmit++;
+    memset(&mSqes[index], 0, sizeof(io_uring_sqe));
+    return &mSqes[index];
+}
+
+
+/**
+ * Submit the entries filled so far, and wait until there are at least
+ * wait completions to take
+ */
+void
+IoUring::submit(unsigned wait)
+{
+    __atomic_store_n(mSqTail, mTail, __ATOMIC_RELEASE);
+    for (;;)
+    {
+        int n = syscall(__NR_io_uring_enter, mFd, mToSubmit, wait,
+                        wait? IORING_ENTER_GETEVENTS: 0, NULL, 0);
+        if (n >= 0)
+        {
+            mToSubmit -= n < (int) mToSubmit? n: mToSubmit;
+            if (mToSubmit == 0)
+                return;
+        }
+        else if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            cerr << "io_uring_enter failed (errno " << errno << ")" << endl;
+            exit(0);
+        }
+    }
+}
+
+
+/**
+ * Take a completion, if there is any
+ */
+bool
+IoUring::complete(__u64& data, int& res)
+{
+    unsigned head = *mCqHead;
+    if (head == __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE))
+        return false;
+    io_uring_cqe& cqe = mCqes[head & mCqMask];
+    data = cqe.user_data;
+    res = cqe.res;
+    __atomic_store_n(mCqHead, head+1, __ATOMIC_RELEASE);
+    return true;
+}
+
+
+// user_data of the entries that close files
+#define CLOSE_DATA (~(__u64) 0)
+
+/**
+ * Open, size and read the files in batches on this thread, through an
+ * io_uring, while numThreads threads parse the files of earlier batches.
+ * The closing of the files of a batch goes with the opening of the next.
+ * Returns false, having read nothing, if there is no io_uring to use.
+ */
+bool
+BulkReader::readIoUring(Parser parse, int numThreads)
+{
+    // open and statx for each file of a batch, and the closes of the last
+    IoUring ring(4 * BULK_READ_BATCH);
+    if (!ring.isOpen())
+        return false;
+
+    // files read, waiting to be parsed
+    mutex lock;
+    condition_variable readable;
+    condition_variable parsed;
+    deque<pair<size_t, vector<char> *> > queue;
+    bool done = false;
+
+    vector<thread> threads;
+    for (int t=0; t < numThreads; t++)
+        threads.push_back(thread([&]() {
+            unique_lock<mutex> guard(lock);
+            for (;;)
+            {
+                while (queue.empty() && !done)
+                    readable.wait(guard);
+                if (queue.empty())
+                    return;
+                pair<size_t, vector<char> *> file = queue.front();
+                queue.pop_front();
+                guard.unlock();
+                parsed.notify_one();
+                vector<char>& text = *file.second;
+                parse(file.first, text.empty()? "": &text[0], text.size());
+                delete file.second;
+                guard.lock();
+            }
+        }));
+
+    vector<int> fds(BULK_READ_BATCH);
+    vector<struct statx> stats(BULK_READ_BATCH);
+    vector<vector<char> *> texts(BULK_READ_BATCH);
+    vector<size_t> readBytes(BULK_READ_BATCH);
+    unsigned toClose = 0;
+    for (size_t b = mFirst; b < mEnd; b += BULK_READ_BATCH)
+    {
+        unsigned n = mEnd - b < BULK_READ_BATCH? mEnd - b: BULK_READ_BATCH;
+
+        // Open and size the files
+        for (unsigned k=0; k < n; k++)
+        {
+            io_uring_sqe * sqe = ring.sqe();
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (__u64) (size_t) mFiles[b+k];
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+            sqe->user_data = 2*k;
+            sqe = ring.sqe();
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (__u64) (size_t) mFiles[b+k];
+            sqe->len = STATX_SIZE;
+            sqe->off = (__u64) (size_t) &stats[k];
+            sqe->user_data = 2*k + 1;
+        }
+        unsigned expected = 2*n + toClose;
+        toClose = 0;
+        for (unsigned got = 0; got < expected; )
+        {
+            ring.submit(expected - got);
+            __u64 data;
+            int res;
+            while (ring.complete(data, res))
+            {
+                got++;
+                if (data == CLOSE_DATA)
+                    continue;
+                if (res < 0)
+                {
+                    cerr << "Cannot find protein file " << mFiles[b + data/2]
+                         << endl;
+                    exit(0);
+                }
+                if (data % 2 == 0)
+                    fds[data/2] = res;
+            }
+        }
+
+        // Read the whole of each file, again where a read comes up short
+        unsigned reading = 0;
+        for (unsigned k=0; k < n; k++)
+        {
+            texts[k] = new vector<char>(stats[k].stx_size);
+            readBytes[k] = 0;
+            if (texts[k]->empty())
+                continue;
+            io_uring_sqe * sqe = ring.sqe();
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = fds[k];
+            sqe->addr = (__u64) (size_t) &(*texts[k])[0];
+            sqe->len = texts[k]->size() < (1U << 30)? texts[k]->size():
+                       (1U << 30);
+            sqe->off = 0;
+            sqe->user_data = k;
+            reading++;
+        }
+        while (reading > 0)
+        {
+            ring.submit(1);
+            __u64 k;
+            int res;
+            while (ring.complete(k, res))
+            {
+                vector<char>& text = *texts[k];
+                if (res < 0)
+                {
+                    cerr << "Cannot read protein file " << mFiles[b+k]
+                         << endl;
+                    exit(0);
+                }
+                readBytes[k] += res;
+                if (res == 0 || readBytes[k] == text.size())
+                {
+                    text.resize(readBytes[k]); // in case it shrank
+                    reading--;
+                    continue;
+                }
+                size_t left = text.size() - readBytes[k];
+                io_uring_sqe * sqe = ring.sqe();
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd = fds[k];
+                sqe->addr = (__u64) (size_t) &text[readBytes[k]];
+                sqe->len = left < (1U << 30)? left: (1U << 30);
+                sqe->off = readBytes[k];
+                sqe->user_data = k;
+            }
+        }
+
+        for (unsigned k=0; k < n; k++)
+        {
+            io_uring_sqe * sqe = ring.sqe();
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = fds[k];
+            sqe->user_data = CLOSE_DATA;
+            toClose++;
+        }
+
+        // Hand the batch to the threads, once the one before is taken
+        unique_lock<mutex> guard(lock);
+        while (queue.size() > BULK_READ_BATCH)
+            parsed.wait(guard);
+        for (unsigned k=0; k < n; k++)
+        {
+            mBytes += texts[k]->size();
+            queue.push_back(make_pair(b+k, texts[k]));
+        }
+        guard.unlock();
+        readable.notify_all();
+    }
+    for (unsigned got = 0; got < toClose; )
+    {
+        ring.submit(toClose - got);
+        __u64 data;
+        int res;
+        while (ring.complete(data, res))
+            got++;
+    }
+
+    {
+        lock_guard<mutex> guard(lock);
+        done = true;
+    }
+    readable.notify_all();
+    for (size_t t=0; t < threads.size(); t++)
+        threads[t].join();
+    return true;
+}
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ *  **************************************************************************
+ *  Copyright 2026 Shuai Cheng Li and Yen Kaow Ng
+ *  **************************************************************************
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  **************************************************************************
+ * 
+ */
+
+
+
+#ifndef _BULK_READER_
+#define _BULK_READER_
+
+#include <stddef.h>
+#include <vector>
+#include <functional>
+
+using namespace std;
+
+// Files opened and read together, through one io_uring submission each
+#define BULK_READ_BATCH 256
+
+
+/**
+ * Reads the whole of each of a list of (small) files, and hands the
+ * contents to a number of parsing threads.
+ *
+ * When built with _USE_IO_URING_ (Linux 5.6 or later), the files are
+ * opened, sized, read and closed in batches of BULK_READ_BATCH through an
+ * io_uring, so that a batch costs a few system calls instead of several
+ * per file, while the threads parse the batches before. At most two
+ * batches wait to be parsed, which bounds the memory used.
+ *
+ * Otherwise, or where the kernel does not allow io_uring (as in some
+ * containers), each of the threads maps and parses files in turn.
+ */
+class BulkReader
+{
+public:
+    typedef function<void(size_t i, const char * data, size_t size)> Parser;
+
+    // The files to read: files[i] for first <= i < end
+    BulkReader(const vector<char *>& files, size_t first, size_t end);
+
+    // Calls parse() on numThreads threads, once for each file, in any order
+    void read(Parser parse, int numThreads);
+
+    size_t mBytes;   // read so far
+    bool mIoUring;   // whether the files were read through an io_uring
+
+private:
+    const vector<char *>& mFiles;
+    size_t mFirst;
+    size_t mEnd;
+
+    void readMapped(Parser parse, int numThreads);
+#ifdef _USE_IO_URING_
+    bool readIoUring(Parser parse, int numThreads);
+#endif
+};
+
+#endif
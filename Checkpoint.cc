@@ -0,0 +1,487 @@
+/*
+ *  **************************************************************************
+ *  Copyright 2026 Shuai Cheng Li and Yen Kaow Ng
+ *  **************************************************************************
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  **************************************************************************
+ * 
+ */
+
+
+
+
+#include <iostream>
+#include <string.h>
+#ifndef __WIN32__
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+
+#include "Checkpoint.h"
+
+using namespace std;
+
+
+char * Checkpoint::fileName = NULL;
+bool Checkpoint::resume = false;
+
+
+// size, padded to a multiple of 8 bytes
+static size_t
+_padded(size_t size)
+{
+    return (size + 7) & ~(size_t) 7;
+}
+
+// Cut the file down to size bytes
+static bool
+_truncate(const char * filename, size_t size)
+{
+#ifndef __WIN32__
+    return truncate(filename, size) == 0;
+#else
+    FILE * file = fopen(filename, "r+b");
+    if (file == NULL)
+        return false;
+    bool truncated = _chsize_s(_fileno(file), size) == 0;
+    fclose(file);
+    return truncated;
+#endif
+}
+
+
+/**
+ * A checkpoint of the clustering of the given key, of numDecoys decoys
+ * (as listed, before filtering), in which the neighbors are counts if
+ * counts is set (LITE mode). It is resumed from filename if resume is set
+ * and filename is such a checkpoint, or else started over.
+ */
+Checkpoint::Checkpoint(const char * filename, const string& key,
+                       int numDecoys, bool counts)
+    : mFileName(filename)
+{
+    mResumed = NULL;
+    mEnd = mSize = mNext = 0;
+    mNumCenters = mNumTaken = 0;
+    mHasThreshold = false;
+    mPendingSince = 0;
+    mQueued = 0;
+    mFile = NULL;
+    mStarted = mStop = mFailed = mWarned = false;
+
+    if (resume && load(key, numDecoys, counts))
+        return;
+
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.byteOrder = CHECKPOINT_BYTE_ORDER;
+    header.numDecoys = numDecoys;
+    header.keySize = key.size();
+    mPending.assign((const char *) &header, (const char *) (&header + 1));
+    mPending.insert(mPending.end(), key.begin(), key.end());
+    mPending.resize(_padded(mPending.size()), '\0');
+    mPendingSince = time(NULL);
+}
+
+
+Checkpoint::~Checkpoint()
+{
+    hand(true);
+    if (mWriter.joinable())
+    {
+        {
+            lock_guard<mutex> lock(mLock);
+            mStop = true;
+        }
+        mHanded.notify_all();
+        mWriter.join();
+    }
+    if (mFile && fclose(mFile))
+        mFailed = true;
+    if (mFailed && !mWarned)
+        cout << "WARNING: cannot write checkpoint \"" << mFileName << "\""
+             << endl;
+    delete mResumed;
+}
+
+
+/**
+ * Take what the checkpoint file holds, up to its last complete record.
+ * Returns false if it is not a checkpoint of this clustering.
+ */
+bool
+Checkpoint::load(const string& key, int numDecoys, bool counts)
+{
+    const char * name = mFileName.c_str();
+    MappedFile * file = new MappedFile(name);
+    if (!file->isOpen())
+    {
+        cout << "No checkpoint \"" << name << "\" to resume from. "
+             << "Starting over" << endl;
+        delete file;
+        return false;
+    }
+    const CheckpointHeader * header = (const CheckpointHeader *) file->mData;
+    size_t size = file->mSize;
+    if (size < sizeof(CheckpointHeader)
+        || memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic))
+        || header->version != CHECKPOINT_VERSION
+        || header->byteOrder != CHECKPOINT_BYTE_ORDER
+        || header->keySize > size - sizeof(CheckpointHeader))
+    {
+        cout << "Checkpoint \"" << name << "\" is of another version, or "
+             << "corrupted. Starting over" << endl;
+        delete file;
+        return false;
+    }
+    if (header->numDecoys != numDecoys
+        || string(file->mData + sizeof(CheckpointHeader), header->keySize)
+           != key)
+    {
+        cout << "Checkpoint \"" << name << "\" is of another clustering. "
+             << "Starting over" << endl;
+        delete file;
+        return false;
+    }
+
+    size_t at = _padded(sizeof(CheckpointHeader) + header->keySize);
+    while (at + sizeof(CheckpointRecord) <= size)
+    {
+        CheckpointRecord record;
+        memcpy(&record, file->mData + at, sizeof(record));
+        const char * data = file->mData + at + sizeof(record);
+        size_t n = record.number;
+        if (record.size > size - at - sizeof(record)) // cut short
+            break;
+
+        bool valid = false;
+        switch (record.part)
+        {
+        case CheckpointRecord::THRESHOLD:
+            valid = !mHasThreshold && record.size == sizeof(float);
+            if (valid)
+            {
+                memcpy(&mThreshold, data, sizeof(float));
+                mHasThreshold = true;
+            }
+            break;
+        case CheckpointRecord::DECOYS:
+            valid = mDecoys.empty() && n > 0 && n <= numDecoys
+                    && record.size == n*sizeof(int);
+            if (valid)
+                mDecoys.assign((const int *) data, (const int *) data + n);
+            for (size_t i=0; valid && i < n; i++)
+                valid = mDecoys[i] >= 0 && mDecoys[i] < numDecoys;
+            break;
+        case CheckpointRecord::REFERENCE:
+            valid = mReference.empty() && n > 0
+                    && record.size == n*sizeof(float);
+            if (valid)
+                mReference.assign((const float *) data,
+                                  (const float *) data + n);
+            break;
+        case CheckpointRecord::AUX:
+            valid = mCen.empty() && n > 0
+                    && record.size == n*(sizeof(int) + sizeof(float));
+            if (valid)
+            {
+                mCen.assign((const int *) data, (const int *) data + n);
+                data += n*sizeof(int);
+                mD2C.assign((const float *) data, (const float *) data + n);
+            }
+            break;
+        case CheckpointRecord::CENTER:
+            // the neighbors found for the centers, in order, of the decoys
+            valid = !mCen.empty() && n == mNumCenters
+                    && record.size % sizeof(Entry) == 0;
+            for (size_t i=0; valid && i < record.size/sizeof(Entry); i++)
+            {
+                const Entry * e = (const Entry *) data + i;
+                valid = e->which >= 0 && e->which < mCen.size() && e->n >= 0
+                        && (counts? e->n <= numDecoys: e->n < mCen.size());
+            }
+            if (valid && mNumCenters++ == 0)
+                mNext = at;
+            break;
+        }
+        if (!valid)
+            break;
+        at += _padded(sizeof(record) + record.size);
+    }
+
+    mResumed = file;
+    mEnd = at;
+    mSize = size;
+    cout << "Resuming from checkpoint \"" << name << "\" (";
+    if (mHasThreshold)
+        cout << "threshold";
+    if (!mDecoys.empty())
+        cout << ", " << mDecoys.size() << " decoys";
+    if (!mReference.empty())
+        cout << ", references";
+    if (!mCen.empty())
+        cout << ", auxiliary clusters";
+    if (mNumCenters)
+        cout << ", neighbors of " << mNumCenters << " centers";
+    cout << ")" << endl;
+    return true;
+}
+
+
+bool
+Checkpoint::threshold(float * threshold)
+{
+    if (mHasThreshold)
+        *threshold = mThreshold;
+    return mHasThreshold;
+}
+
+/**
+ * The ids of the decoys kept by filtering, or NULL if not known
+ */
+const vector<int> *
+Checkpoint::decoys()
+{
+    return mDecoys.empty()? NULL: &mDecoys;
+}
+
+/**
+ * The distances to the references (size of them), or NULL if not known
+ */
+const float *
+Checkpoint::reference(size_t size)
+{
+    return mReference.size() == size? &mReference[0]: NULL;
+}
+
+/**
+ * Set cen and d2c to the center of each decoy and its distance to it in the
+ * auxiliary partition of numDecoys decoys. Returns false if not known.
+ */
+bool
+Checkpoint::aux(int numDecoys, const int ** cen, const float ** d2c)
+{
+    if (mCen.size() != numDecoys)
+        return false;
+
+    // A center comes before the decoys around it, and is its own center
+    for (int i=0; i < numDecoys; i++)
+    {
+        int c = mCen[i];
+        if (c < 0 || c > i || mCen[c] != c)
+            return false;
+    }
+    *cen = &mCen[0];
+    *d2c = &mD2C[0];
+    return true;
+}
+
+/**
+ * Set entries to the neighbors added for the next center resumed, in the
+ * order they were added. Returns false once there are none left.
+ */
+bool
+Checkpoint::nextCenter(const Entry ** entries, size_t * numEntries)
+{
+    if (mResumed == NULL || mNumTaken == mNumCenters)
+    {
+        delete mResumed; // nothing more is taken from it
+        mResumed = NULL;
+        return false;
+    }
+    CheckpointRecord record;
+    memcpy(&record, mResumed->mData + mNext, sizeof(record));
+    *entries = (const Entry *) (mResumed->mData + mNext + sizeof(record));
+    *numEntries = record.size / sizeof(Entry);
+    mNext += _padded(sizeof(record) + record.size);
+    mNumTaken++;
+    return true;
+}
+
+
+void
+Checkpoint::putThreshold(float threshold)
+{
+    if (mHasThreshold)
+        return;
+    mHasThreshold = true;
+    mThreshold = threshold;
+    put(CheckpointRecord::THRESHOLD, 1, &threshold, sizeof(float));
+    hand(true);
+}
+
+void
+Checkpoint::putDecoys(const vector<int>& ids)
+{
+    if (!mDecoys.empty())
+        return;
+    put(CheckpointRecord::DECOYS, ids.size(), &ids[0], ids.size()*sizeof(int));
+    hand(true);
+}
+
+void
+Checkpoint::putReference(const float * reference, size_t size)
+{
+    if (!mReference.empty())
+        return;
+    put(CheckpointRecord::REFERENCE, size, reference, size*sizeof(float));
+    hand(true);
+}
+
+void
+Checkpoint::putAux(int numDecoys, const int * cen, const float * d2c)
+{
+    if (!mCen.empty())
+        return;
+    put(CheckpointRecord::AUX, numDecoys, cen, numDecoys*sizeof(int),
+        d2c, numDecoys*sizeof(float));
+    hand(true);
+}
+
+/**
+ * The neighbors added for the c-th center, which are handed to the writer
+ * along with those of the next centers
+ */
+void
+Checkpoint::putCenter(int c, const vector<Entry>& entries)
+{
+    if (c < mNumCenters) // resumed
+        return;
+    put(CheckpointRecord::CENTER, c, entries.empty()? NULL: &entries[0],
+        entries.size()*sizeof(Entry));
+    hand(false);
+}
+
+
+/**
+ * Add a record of data, followed by data2 if given, to what is to be
+ * handed to the writer
+ */
+void
+Checkpoint::put(unsigned int part, unsigned int number, const void * data,
+                size_t size, const void * data2, size_t size2)
+{
+    if (mPending.empty())
+        mPendingSince = time(NULL);
+    CheckpointRecord record;
+    memset(&record, 0, sizeof(record));
+    record.part = part;
+    record.number = number;
+    record.size = size + size2;
+    mPending.insert(mPending.end(), (const char *) &record,
+                    (const char *) (&record + 1));
+    mPending.insert(mPending.end(), (const char *) data,
+                    (const char *) data + size);
+    if (data2)
+        mPending.insert(mPending.end(), (const char *) data2,
+                        (const char *) data2 + size2);
+    mPending.resize(_padded(mPending.size()), '\0');
+}
+
+/**
+ * Hand what was put to the writer, if now is set, or if it is large or old
+ * enough. Waits while the writer is too far behind.
+ */
+void
+Checkpoint::hand(bool now)
+{
+    if (mPending.empty())
+        return;
+    if (!now && mPending.size() < CHECKPOINT_BLOCK_BYTES
+        && time(NULL) - mPendingSince < CHECKPOINT_SECONDS)
+        return;
+    if (!mStarted)
+        start();
+
+    unique_lock<mutex> lock(mLock);
+    while (!mFailed && mQueued > CHECKPOINT_QUEUE_BYTES)
+        mWritten.wait(lock);
+    if (mFailed)
+    {
+        mPending.clear();
+        if (!mWarned)
+            cout << "WARNING: cannot write checkpoint \"" << mFileName
+                 << "\"" << endl;
+        mWarned = true;
+        return;
+    }
+    mQueued += mPending.size();
+    mQueue.push_back(vector<char>());
+    mQueue.back().swap(mPending);
+    lock.unlock();
+    mHanded.notify_one();
+}
+
+/**
+ * Open the checkpoint file, to write on after what was resumed (which is no
+ * longer taken from), or from the start, and start the writer
+ */
+void
+Checkpoint::start()
+{
+    mStarted = true;
+    delete mResumed;
+    mResumed = NULL;
+    mNumTaken = mNumCenters;
+
+    const char * name = mFileName.c_str();
+    if (mEnd > 0 && (mEnd == mSize || _truncate(name, mEnd)))
+        mFile = fopen(name, "ab");
+    else if (mEnd == 0)
+        mFile = fopen(name, "wb");
+    if (mFile == NULL)
+    {
+        mFailed = true;
+        return;
+    }
+    mWriter = thread(&Checkpoint::work, this);
+}
+
+/**
+ * Write out what is handed, in order, until stopped
+ */
+void
+Checkpoint::work()
+{
+    unique_lock<mutex> lock(mLock);
+    for (;;)
+    {
+        while (mQueue.empty() && !mStop)
+            mHanded.wait(lock);
+        if (mQueue.empty())
+            return;
+        vector<char> block;
+        block.swap(mQueue.front());
+        mQueue.pop_front();
+        lock.unlock();
+        bool written = fwrite(&block[0], block.size(), 1, mFile) == 1
+                       && fflush(mFile) == 0;
+        lock.lock();
+        mQueued -= block.size();
+        if (!written)
+        {
+            mFailed = true;
+            mQueue.clear();
+            mQueued = 0;
+        }
+        mWritten.notify_all();
+        if (mFailed)
+            return;
+    }
+}
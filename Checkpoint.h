@@ -0,0 +1,169 @@
+/*
+ *  **************************************************************************
+ *  Copyright 2026 Shuai Cheng Li and Yen Kaow Ng
+ *  **************************************************************************
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  **************************************************************************
+ * 
+ */
+
+
+
+
+#ifndef _CHECKPOINT_
+#define _CHECKPOINT_
+
+#include <stdio.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "MappedFile.h"
+
+using namespace std;
+
+
+#define CHECKPOINT_MAGIC "CALICKP\x1a"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_BYTE_ORDER 0x01020304
+// Neighbors kept in memory before being handed to the writer...
+#define CHECKPOINT_BLOCK_BYTES (4*1024*1024)
+// ...unless they have been kept this many seconds
+#define CHECKPOINT_SECONDS 30
+// Most bytes handed to the writer and not yet written
+#define CHECKPOINT_QUEUE_BYTES (64*1024*1024)
+
+/**
+ * Header of a checkpoint file (see Checkpoint). It is followed by the key
+ * of the clustering, keySize characters, and then by records, each a
+ * CheckpointRecord and its data.
+ */
+struct CheckpointHeader
+{
+    char magic[8];              // CHECKPOINT_MAGIC
+    unsigned int version;       // CHECKPOINT_VERSION
+    unsigned int byteOrder;     // CHECKPOINT_BYTE_ORDER
+    unsigned int numDecoys;     // listed in the input, before filtering
+    unsigned int keySize;
+};
+
+/**
+ * A record of a checkpoint file, followed by size bytes of data:
+ * THRESHOLD: the threshold, a float
+ * DECOYS: the ids of the decoys kept by filtering, number ints
+ * REFERENCE: the distances of the decoys to the references, number floats
+ * AUX: the auxiliary partition, as the center of each of number decoys
+ *      (ints) and then its distance to it (floats)
+ * CENTER: the neighbors added for the number-th auxiliary cluster center,
+ *      as Checkpoint::Entry's, the centers in order
+ * Each record is padded to a multiple of 8 bytes, as is the key.
+ */
+struct CheckpointRecord
+{
+    enum { THRESHOLD = 1, DECOYS, REFERENCE, AUX, CENTER };
+    unsigned int part;
+    unsigned int number;
+    unsigned long long size;
+};
+
+
+/**
+ * The state of a clustering, kept in a file as it is reached, so that a
+ * clustering which is stopped (e.g. preempted) can be resumed from where it
+ * was: the threshold, the decoys kept by filtering, the distances to the
+ * references, the auxiliary partition, and the neighbors found for each
+ * auxiliary cluster center that was done (see Clustering::cluster).
+ *
+ * The parts are added to a buffer which a thread of its own writes out,
+ * the neighbors of a number of centers at a time, so that clustering goes
+ * on while they are written. A resumed checkpoint is read up to its last
+ * complete record, and written on from there once its neighbors have been
+ * taken (nextCenter() returns false).
+ */
+class Checkpoint
+{
+public:
+    static char * fileName;     // --checkpoint FILE, or NULL
+    static bool resume;         // whether to resume from it (--resume)
+
+    struct Entry
+    {
+        int which;  // the decoy that a neighbor is added to
+        int n;      // the neighbor (the number of decoys in LITE mode)
+        float d;    // its distance
+    };
+
+private:
+    string mFileName;
+    MappedFile * mResumed;      // until its neighbors are taken
+    size_t mEnd;                // of the last complete record resumed
+    size_t mSize;               // of the file resumed
+    size_t mNext;               // of the next CENTER record to take
+    int mNumCenters;            // the CENTER records resumed...
+    int mNumTaken;              // ...and of them taken
+    bool mHasThreshold;
+    float mThreshold;
+    vector<int> mDecoys;
+    vector<float> mReference;
+    vector<int> mCen;
+    vector<float> mD2C;
+
+    string mHeader;             // to write first, if starting over
+    vector<char> mPending;      // not yet handed to the writer
+    time_t mPendingSince;
+    deque<vector<char> > mQueue; // handed to the writer
+    size_t mQueued;             // bytes in mQueue
+    FILE * mFile;
+    bool mStarted;              // whether the writer was started
+    bool mStop;
+    bool mFailed;               // whether a write failed...
+    bool mWarned;               // ...and it was told
+    mutex mLock;
+    condition_variable mHanded;
+    condition_variable mWritten;
+    thread mWriter;
+
+    bool load(const string& key, int numDecoys, bool counts);
+    void put(unsigned int part, unsigned int number, const void * data,
+             size_t size, const void * data2 = NULL, size_t size2 = 0);
+    void hand(bool now);
+    void start();
+    void work();
+
+public:
+    Checkpoint(const char * filename, const string& key, int numDecoys,
+               bool counts);
+    ~Checkpoint();
+
+    bool threshold(float * threshold);
+    const vector<int> * decoys();
+    const float * reference(size_t size);
+    bool aux(int numDecoys, const int ** cen, const float ** d2c);
+    int numCenters() { return mNumCenters; }
+    bool nextCenter(const Entry ** entries, size_t * numEntries);
+
+    void putThreshold(float threshold);
+    void putDecoys(const vector<int>& ids);
+    void putReference(const float * reference, size_t size);
+    void putAux(int numDecoys, const int * cen, const float * d2c);
+    void putCenter(int c, const vector<Entry>& entries);
+};
+
+#endif
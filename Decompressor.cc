@@ -0,0 +1,220 @@
+/*
+ *  **************************************************************************
+ *  Copyright 2026 Shuai Cheng Li and Yen Kaow Ng
+ *  **************************************************************************
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  **************************************************************************
+ * 
+ */
+
+
+#include <iostream>
+
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef _USE_ZLIB_
+#include <zlib.h>
+#endif
+#ifdef _USE_ZSTD_
+#include <zstd.h>
+#endif
+
+#include "Decompressor.h"
+
+using namespace std;
+
+
+COMPRESSION
+compression(const char * data, size_t size)
+{
+    const unsigned char * d = (const unsigned char *) data;
+    if (size >= 2 && d[0] == 0x1f && d[1] == 0x8b)
+        return GZIP;
+    if (size >= 4 && d[0] == 0x28 && d[1] == 0xb5 && d[2] == 0x2f
+        && d[3] == 0xfd)
+        return ZSTD;
+    return NOT_COMPRESSED;
+}
+
+
+Decompressor::Decompressor(const char * data, size_t size,
+                           const char * filename)
+{
+    mType = compression(data, size);
+    mFileName = filename;
+    mData = data;
+    mSize = size;
+    mEnd = false;
+    mState = NULL;
+
+    switch (mType)
+    {
+#ifdef _USE_ZLIB_
+        case GZIP:
+        {
+            z_stream * z = new z_stream;
+            memset(z, 0, sizeof(z_stream));
+            if (inflateInit2(z, 15+16) != Z_OK) // 16: gzip header
+            {
+                cerr << "Cannot decompress \"" << filename << "\"" << endl;
+                exit(0);
+            }
+            mState = z;
+            break;
+        }
+#endif
+#ifdef _USE_ZSTD_
+        case ZSTD:
+            mState = ZSTD_createDStream();
+            if (mState == NULL || ZSTD_isError(ZSTD_initDStream(
+                                      (ZSTD_DStream *) mState)))
+            {
+                cerr << "Cannot decompress \"" << filename << "\"" << endl;
+                exit(0);
+            }
+            break;
+#endif
+        case NOT_COMPRESSED:
+            break;
+        default:
+            cerr << "\"" << filename << "\" is " 
+                 << (mType == GZIP? "gzip": "zstd") << "-compressed, "
+                 << "but this calibur was built without support for it"
+                 << endl;
+            exit(0);
+    }
+}
+
+Decompressor::~Decompressor()
+{
+#ifdef _USE_ZLIB_
+    if (mType == GZIP)
+    {
+        inflateEnd((z_stream *) mState);
+        delete (z_stream *) mState;
+    }
+#endif
+#ifdef _USE_ZSTD_
+    if (mType == ZSTD)
+        ZSTD_freeDStream((ZSTD_DStream *) mState);
+#endif
+}
+
+size_t
+Decompressor::read(char * buf, size_t size)
+{
+    size_t done = 0;
+    switch (mType)
+    {
+        case NOT_COMPRESSED:
+            done = size < mSize? size: mSize;
+            memcpy(buf, mData, done);
+            mData += done;
+            mSize -= done;
+            return done;
+#ifdef _USE_ZLIB_
+        case GZIP:
+        {
+            z_stream * z = (z_stream *) mState;
+            while (done < size)
+            {
+                if (mEnd) // of a member. Another may follow
+                {
+                    if (mSize == 0)
+                        break;
+                    inflateReset(z);
+                    mEnd = false;
+                }
+                // avail_in and avail_out are only 32 bits wide
+                uInt in = mSize < (1u<<30)? (uInt) mSize: (1u<<30);
+                uInt out = size - done < (1u<<30)? size - done: (1u<<30);
+                z->next_in = (Bytef *) mData;
+                z->avail_in = in;
+                z->next_out = (Bytef *) buf + done;
+                z->avail_out = out;
+                int ret = inflate(z, Z_NO_FLUSH);
+                mData += in - z->avail_in;
+                mSize -= in - z->avail_in;
+                done += out - z->avail_out;
+                if (ret == Z_STREAM_END)
+                    mEnd = true;
+                else if (ret == Z_BUF_ERROR) // no progress possible
+                    break;
+                else if (ret != Z_OK)
+                {
+                    cerr << "Corrupted gzip data in \"" << mFileName << "\""
+                         << endl;
+                    exit(0);
+                }
+            }
+            break;
+        }
+#endif
+#ifdef _USE_ZSTD_
+        case ZSTD:
+        {
+            ZSTD_inBuffer in = {mData, mSize, 0};
+            ZSTD_outBuffer out = {buf, size, 0};
+            while (out.pos < out.size)
+            {
+                size_t inPos = in.pos;
+                size_t outPos = out.pos;
+                size_t ret = ZSTD_decompressStream((ZSTD_DStream *) mState,
+                                                   &out, &in);
+                if (ZSTD_isError(ret))
+                {
+                    cerr << "Corrupted zstd data in \"" << mFileName << "\""
+                         << endl;
+                    exit(0);
+                }
+                if (in.pos == inPos && out.pos == outPos)
+                    break;
+                mEnd = ret == 0; // a frame is done, and fully flushed
+            }
+            mData += in.pos;
+            mSize -= in.pos;
+            done = out.pos;
+            break;
+        }
+#endif
+        default:
+            break;
+    }
+    if (done < size && !(mEnd && mSize == 0)) // stopped short of the end
+    {
+        cerr << "Compressed data in \"" << mFileName << "\" ends early"
+             << endl;
+        exit(0);
+    }
+    return done;
+}
+
+void
+Decompressor::readAll(vector<char>& out)
+{
+    size_t start = out.size();
+    size_t block = mSize < 65536? 65536: mSize; // guess: 2x compression
+    for (;;)
+    {
+        out.resize(start + 2*block);
+        size_t n = read(&out[start], 2*block);
+        start += n;
+        if (n == 0)
+            break;
+    }
+    out.resize(start);
+}
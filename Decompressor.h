@@ -0,0 +1,68 @@
+/*
+ *  **************************************************************************
+ *  Copyright 2026 Shuai Cheng Li and Yen Kaow Ng
+ *  **************************************************************************
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  **************************************************************************
+ * 
+ */
+
+
+#ifndef _DECOMPRESSOR_
+#define _DECOMPRESSOR_
+
+#include <stddef.h>
+#include <vector>
+
+using namespace std;
+
+
+enum COMPRESSION { NOT_COMPRESSED, GZIP, ZSTD };
+
+// The compression of data, as told by its magic bytes
+COMPRESSION compression(const char * data, size_t size);
+
+
+/**
+ * Decompresses a gzip (when compiled with _USE_ZLIB_) or zstd (when
+ * compiled with _USE_ZSTD_) compressed file held in memory, e.g. in a
+ * MappedFile. Concatenated gzip members and zstd frames are read as one.
+ *
+ * Errors, including a compression that was not compiled in, end the
+ * program with a message naming the file.
+ */
+class Decompressor
+{
+public:
+    Decompressor(const char * data, size_t size, const char * filename);
+    ~Decompressor();
+
+    // Decompress size bytes into buf. Returns less only at the end of data
+    size_t read(char * buf, size_t size);
+
+    // Decompress everything that is left, appending it to out
+    void readAll(vector<char>& out);
+
+private:
+    COMPRESSION mType;
+    const char * mFileName;
+    const char * mData;   // compressed data not yet consumed
+    size_t mSize;
+    bool mEnd;            // the end of the last member or frame was reached
+    void * mState;        // of zlib or zstd
+};
+
+#endif
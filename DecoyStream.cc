@@ -0,0 +1,304 @@
+/*
+ *  **************************************************************************
+ *  Copyright 2026 Shuai Cheng Li and Yen Kaow Ng
+ *  **************************************************************************
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  **************************************************************************
+ * 
+ */
+
+
+
+
+
+
+#include <string.h>
+#include <stdlib.h>
+#include "DecoyStream.h"
+#ifdef __WIN32__
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+// Bytes read from the stream at a time
+#define STREAM_READ_BYTES (64*1024)
+
+
+DecoyStream::DecoyStream(FILE * input)
+{
+    mInput = input;
+    mNumResidues = 0;
+    mTaken = 0;
+    mEnd = false;
+#ifdef __WIN32__
+    _setmode(_fileno(input), _O_BINARY);
+#endif
+    SimPDB::selection(); // compiled here, before the thread shares it
+    mThread = thread([this]() {
+        char head[8];
+        size_t size = fread(head, 1, sizeof(head), mInput);
+        if (size == sizeof(head) && !memcmp(head, STREAM_MAGIC, 8))
+            readBinary();
+        else
+            readText(head, size);
+        lock_guard<mutex> lock(mLock);
+        mEnd = true;
+        mArrived.notify_all();
+    });
+}
+
+
+DecoyStream::~DecoyStream()
+{
+    if (mThread.joinable())
+        mThread.join();
+}
+
+
+bool
+DecoyStream::take(size_t numDecoys, vector<SimPDB *>& pdbs,
+                  vector<char *>& names)
+{
+    unique_lock<mutex> lock(mLock);
+    while (!mEnd && (numDecoys == 0 || mPDBs.size() < numDecoys))
+        mArrived.wait(lock);
+    for (; mTaken < mPDBs.size(); mTaken++)
+    {
+        pdbs.push_back(mPDBs[mTaken]);
+        names.push_back(mNames[mTaken]);
+    }
+    if (!mEnd)
+        return false;
+    lock.unlock();
+    if (mThread.joinable()) // the thread is done
+        mThread.join();
+    return true;
+}
+
+
+int
+DecoyStream::numResidues()
+{
+    unique_lock<mutex> lock(mLock);
+    while (!mEnd && mNumResidues == 0)
+        mArrived.wait(lock);
+    return mNumResidues;
+}
+
+
+/**
+ * Room for the coordinates of the next decoy. Only the reading thread
+ * adds blocks, so it needs no lock to look at them
+ */
+float *
+DecoyStream::slot(int numResidues)
+{
+    size_t i = mPDBs.size() % STREAM_BLOCK_DECOYS;
+    if (i == 0)
+        mBlocks.push_back(new float[(size_t) 3*numResidues
+                                    *STREAM_BLOCK_DECOYS]);
+    return mBlocks.back() + (size_t) 3*numResidues*i;
+}
+
+
+/**
+ * Give out the decoy in the last slot, named name (or by its number if
+ * name is NULL)
+ */
+void
+DecoyStream::add(float * coords, char * name)
+{
+    if (name == NULL)
+    {
+        name = new char[32];
+        sprintf(name, "stdin#%zu", mPDBs.size() + 1);
+    }
+    SimPDB * pdb = new SimPDB();
+    pdb->mDecoyID = mPDBs.size();
+    pdb->mProteinFileName = name;
+    pdb->mNumResidue = mNumResidues;
+    pdb->mCAlpha = coords;
+    pdb->mOwnsCAlpha = false; // owned by mBlocks
+
+    lock_guard<mutex> lock(mLock);
+    mPDBs.push_back(pdb);
+    mNames.push_back(name);
+    mArrived.notify_all();
+}
+
+
+/**
+ * Read binary records, after the magic number
+ */
+void
+DecoyStream::readBinary()
+{
+    unsigned int numResidues;
+    if (fread(&numResidues, sizeof(numResidues), 1, mInput) != 1
+        || numResidues == 0 || numResidues > LONGEST_CHAIN)
+    {
+        cout << "Error: bad header in the decoy stream" << endl;
+        exit(0);
+    }
+    {
+        lock_guard<mutex> lock(mLock);
+        mNumResidues = numResidues;
+    }
+    cout << "Decoys of " << numResidues << " atoms in the decoy stream"
+         << endl;
+
+    unsigned int nameLength;
+    while (fread(&nameLength, sizeof(nameLength), 1, mInput) == 1)
+    {
+        if (nameLength > 4096)
+        {
+            cout << "Error: bad record " << mPDBs.size() + 1
+                 << " in the decoy stream" << endl;
+            exit(0);
+        }
+        char * name = NULL;
+        if (nameLength > 0)
+        {
+            name = new char[nameLength + 1];
+            name[nameLength] = '\0';
+        }
+        float * coords = slot(numResidues);
+        if ((nameLength > 0 && fread(name, 1, nameLength, mInput)
+                               != nameLength)
+            || fread(coords, sizeof(float)*3, numResidues, mInput)
+               != numResidues)
+        {
+            cout << "Error: the decoy stream ends in the middle of decoy "
+                 << mPDBs.size() + 1 << endl;
+            exit(0);
+        }
+        center_residues(coords, numResidues);
+        add(coords, name);
+    }
+}
+
+
+/**
+ * Read PDB models, which begin (as in PreloadedPDB::loadModels) at a MODEL
+ * record or at an ATOM record outside of any model, and end at an ENDMDL
+ * or END record, at the next MODEL record, or at the end of the stream.
+ * Each model is parsed as soon as its end has arrived
+ */
+void
+DecoyStream::readText(const char * head, size_t headSize)
+{
+    vector<char> text(head, head + headSize);
+    size_t next = 0;        // the first line not yet looked at
+    long long model = -1;   // where the current model begins, if in one
+    bool more = true;
+    while (more)
+    {
+        size_t size = text.size();
+        text.resize(size + STREAM_READ_BYTES);
+        size_t count = fread(&text[size], 1, STREAM_READ_BYTES, mInput);
+        text.resize(size + count);
+        more = count > 0;
+
+        for (;;)
+        {
+            const char * line = text.data() + next;
+            const char * eol = (const char *) memchr(line, '\n',
+                                                     text.size() - next);
+            if (eol == NULL && more)
+                break; // wait for the rest of the line
+            size_t end = eol? eol + 1 - text.data(): text.size();
+            int len = (eol? eol: text.data() + end) - line;
+            if (len > 0 && line[len-1] == '\r')
+                len--;
+
+            // Where the current model ends, if here
+            long long modelEnd = -1;
+            if (len >= 5 && !strncmp(line, "MODEL", 5)
+                && (len == 5 || line[5] == ' '))
+            {
+                modelEnd = model >= 0? next: -1;
+                if (modelEnd < 0)
+                    model = next;
+            }
+            else if (len >= 6 && (!strncmp(line, "ATOM  ", 6)
+                                  || !strncmp(line, "HETATM", 6)))
+            {
+                if (model < 0)
+                    model = next;
+            }
+            else if (model >= 0 && len >= 3 && !strncmp(line, "END", 3)
+                     && (len == 3 || line[3] == ' '
+                         || (len >= 6 && !strncmp(line, "ENDMDL", 6))))
+                modelEnd = end;
+            if (model >= 0 && eol == NULL)
+                modelEnd = end;
+
+            if (modelEnd >= 0)
+            {
+                int room = mNumResidues > 0? mNumResidues: LONGEST_CHAIN;
+                float * coords = mNumResidues > 0? slot(mNumResidues):
+                                 new float[3*room];
+                size_t used;
+                int n = parse_pdb(text.data() + model, modelEnd - model,
+                                  coords, room, &used);
+                if (mNumResidues == 0)
+                {
+                    if (n <= 0)
+                    {
+                        cout << "Error: no residue in decoy 1 of the "
+                             << "decoy stream" << endl;
+                        exit(0);
+                    }
+                    lock_guard<mutex> lock(mLock);
+                    mNumResidues = n < room? n: room;
+                }
+                if (n != mNumResidues)
+                {
+                    cout << "Error: decoy " << mPDBs.size() + 1
+                         << " of the decoy stream "
+                         << "has mismatching number of residues"
+                         << " (should have " << mNumResidues << " but has "
+                         << n << ")" << endl;
+                    exit(0);
+                }
+                if (mPDBs.empty())
+                {
+                    cout << "Specifications result in " << mNumResidues
+                         << " atoms" << endl;
+                    float * first = coords;
+                    coords = slot(mNumResidues);
+                    memcpy(coords, first, sizeof(float)*3*mNumResidues);
+                    delete [] first;
+                }
+                center_residues(coords, mNumResidues);
+                add(coords, NULL);
+
+                // A MODEL record which ends a model begins the next
+                model = modelEnd == next? next: -1;
+            }
+            next = end;
+            if (eol == NULL)
+                break;
+        }
+
+        // Drop the lines which are no longer needed
+        size_t keep = model >= 0? model: next;
+        text.erase(text.begin(), text.begin() + keep);
+        next -= keep;
+        if (model >= 0)
+            model = 0;
+    }
+}
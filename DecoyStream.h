@@ -0,0 +1,98 @@
+/*
+ *  **************************************************************************
+ *  Copyright 2026 Shuai Cheng Li and Yen Kaow Ng
+ *  **************************************************************************
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  **************************************************************************
+ * 
+ */
+
+
+
+#ifndef _DECOY_STREAM_
+#define _DECOY_STREAM_
+
+#include <stdio.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "SimpPDB.h"
+
+using namespace std;
+
+
+#define STREAM_MAGIC "CALSTRM\x1a"
+// Decoys in each block of coordinates of a DecoyStream
+#define STREAM_BLOCK_DECOYS 1024
+
+
+/**
+ * Decoys read from a stream (the standard input) on a background thread,
+ * so that they can be used while more are still arriving.
+ *
+ * The stream is either text, a PDB model after another (as concatenated
+ * PDB files, or MODEL ... ENDMDL blocks), from which the atoms are
+ * selected as from a PDB file; or binary, a header
+ *
+ *     char magic[8];            // STREAM_MAGIC
+ *     unsigned int numResidues; // atoms of each decoy
+ *
+ * followed by a record for each decoy
+ *
+ *     unsigned int nameLength;  // 0 to name the decoy by its number
+ *     char name[nameLength];
+ *     float coords[3*numResidues];
+ *
+ * of the atoms to use, in the byte order of the machine. Decoys without
+ * names are named stdin#N, for the N-th decoy.
+ *
+ * Decoys go into blocks which are never moved, so a decoy, once given out
+ * by take(), stays where it is. Errors end the program with a message.
+ */
+class DecoyStream
+{
+public:
+    DecoyStream(FILE * input);
+    ~DecoyStream();
+
+    // Wait until numDecoys decoys (all of them if 0) have arrived, then
+    // append those not taken before to pdbs and names. Returns whether
+    // all the decoys have been taken.
+    bool take(size_t numDecoys, vector<SimPDB *>& pdbs,
+              vector<char *>& names);
+    int numResidues(); // once the first decoy has arrived
+
+private:
+    FILE * mInput;
+    int mNumResidues;            // 0 until known
+    vector<float *> mBlocks;
+    vector<SimPDB *> mPDBs;      // arrived
+    vector<char *> mNames;
+    size_t mTaken;
+    bool mEnd;
+    mutex mLock;                 // for mNumResidues, mPDBs, mNames, mEnd
+    condition_variable mArrived;
+    thread mThread;
+
+    void readText(const char * head, size_t headSize);
+    void readBinary();
+    float * slot(int numResidues);
+    void add(float * coords, char * name);
+};
+
+#endif
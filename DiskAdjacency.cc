@@ -0,0 +1,220 @@
+/*
+ *  **************************************************************************
+ *  Copyright 2026 Shuai Cheng Li and Yen Kaow Ng
+ *  **************************************************************************
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  **************************************************************************
+ * 
+ */
+
+
+#include <iostream>
+#include <algorithm>
+#include <queue>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#ifndef __WIN32__
+#include <unistd.h>
+#else
+#include <process.h>
+#define getpid _getpid
+#endif
+
+#include "DiskAdjacency.h"
+
+using namespace std;
+
+
+// NULL to use $TMPDIR (or /tmp)
+char * DiskAdjacency::scratchDir = NULL;
+
+
+DiskAdjacency::DiskAdjacency(int numDecoys, double bufferBytes)
+{
+    mNumDecoys = numDecoys;
+    mMaxBuffered = (size_t) (bufferBytes / sizeof(Record));
+    if (mMaxBuffered < 1024)
+        mMaxBuffered = 1024;
+    mOffsets = new size_t[numDecoys+1];
+    memset(mOffsets, 0, (numDecoys+1)*sizeof(size_t));
+    mLists = NULL;
+
+    mBlockFileName = scratchFileName(this, "blocks");
+    mListFileName = scratchFileName(this, "lists");
+    mBlockFile = fopen(mBlockFileName, "w+b");
+    if (!mBlockFile)
+    {
+        cerr << "Cannot create scratch file \"" << mBlockFileName << "\""
+             << endl;
+        exit(0);
+    }
+}
+
+DiskAdjacency::~DiskAdjacency()
+{
+    if (mBlockFile)
+    {
+        fclose(mBlockFile);
+        remove(mBlockFileName);
+    }
+    if (mLists)
+    {
+        delete mLists;
+        remove(mListFileName);
+    }
+    delete [] mOffsets;
+    free(mBlockFileName);
+    free(mListFileName);
+}
+
+char *
+DiskAdjacency::scratchFileName(const void * owner, const char * suffix)
+{
+    const char * dir = scratchDir;
+    if (dir == NULL)
+        dir = getenv("TMPDIR");
+#ifdef __WIN32__
+    if (dir == NULL)
+        dir = getenv("TEMP");
+    if (dir == NULL)
+        dir = ".";
+#else
+    if (dir == NULL)
+        dir = "/tmp";
+#endif
+    char * name = (char *) malloc(strlen(dir) + strlen(suffix) + 64);
+    sprintf(name, "%s/calibur.%d.%p.%s", dir, (int) getpid(), owner, suffix);
+    return name;
+}
+
+void
+DiskAdjacency::add(int which, int n, float d)
+{
+    Record r;
+    r.which = which;
+    r.e.n = n;
+    r.e.d = d;
+    mBuffer.push_back(r);
+    mOffsets[which+1]++; // counted here, summed up in finish()
+    if (mBuffer.size() >= mMaxBuffered)
+        flush();
+}
+
+struct _RecordByDecoy
+{
+    template <class R>
+    bool operator()(const R& a, const R& b) const { return a.which < b.which; }
+};
+
+/**
+ * Write out the buffer as one block sorted by decoy. The sort is stable, so
+ * that the neighbors of a decoy stay in the order they were added.
+ */
+void
+DiskAdjacency::flush()
+{
+    if (mBuffer.empty())
+        return;
+    stable_sort(mBuffer.begin(), mBuffer.end(), _RecordByDecoy());
+    if (fwrite(&mBuffer[0], sizeof(Record), mBuffer.size(), mBlockFile)
+        != mBuffer.size())
+    {
+        cerr << "Cannot write scratch file \"" << mBlockFileName << "\""
+             << endl;
+        exit(0);
+    }
+    size_t end = mBlockEnds.empty()? 0: mBlockEnds.back();
+    mBlockEnds.push_back(end + mBuffer.size());
+    mBuffer.clear();
+}
+
+/**
+ * Merge the blocks into the list file, where the neighbors of each decoy
+ * are contiguous, and map the list file back into memory
+ */
+void
+DiskAdjacency::finish()
+{
+    flush();
+    vector<Record>().swap(mBuffer); // release the buffer's memory
+    fclose(mBlockFile);
+    mBlockFile = NULL;
+
+    for (int i=0; i < mNumDecoys; i++)
+        mOffsets[i+1] += mOffsets[i];
+
+    MappedFile * blocks = new MappedFile(mBlockFileName);
+    const Record * records = (const Record *) blocks->mData;
+    FILE * lists = fopen(mListFileName, "wb");
+    if (!blocks->isOpen() || !lists)
+    {
+        cerr << "Cannot create scratch file \"" << mListFileName << "\""
+             << endl;
+        exit(0);
+    }
+
+    // k-way merge of the blocks. Ties go to the earlier block, which keeps
+    // the order in which the neighbors were added
+    typedef pair<int, int> Cursor; // (decoy, block)
+    priority_queue<Cursor, vector<Cursor>, greater<Cursor> > heads;
+    vector<size_t> pos(mBlockEnds.size());
+    for (int b=0; b < mBlockEnds.size(); b++)
+    {
+        pos[b] = b == 0? 0: mBlockEnds[b-1];
+        if (pos[b] < mBlockEnds[b])
+            heads.push(Cursor(records[pos[b]].which, b));
+    }
+    while (!heads.empty())
+    {
+        int which = heads.top().first;
+        int b = heads.top().second;
+        heads.pop();
+        for (; pos[b] < mBlockEnds[b] && records[pos[b]].which == which;
+             pos[b]++)
+            fwrite(&records[pos[b]].e, sizeof(Entry), 1, lists);
+        if (pos[b] < mBlockEnds[b])
+            heads.push(Cursor(records[pos[b]].which, b));
+    }
+    fclose(lists);
+    delete blocks;
+    remove(mBlockFileName);
+
+    mLists = new MappedFile(mListFileName);
+    if (!mLists->isOpen())
+    {
+        cerr << "Cannot map scratch file \"" << mListFileName << "\"" << endl;
+        exit(0);
+    }
+#ifndef __WIN32__
+    // The mapping stays valid without the name, and nothing is left behind
+    // when we exit without destroying this
+    remove(mListFileName);
+#endif
+}
+
+int
+DiskAdjacency::size(int which)
+{
+    return (int) (mOffsets[which+1] - mOffsets[which]);
+}
+
+const DiskAdjacency::Entry *
+DiskAdjacency::list(int which)
+{
+    return (const Entry *) mLists->mData + mOffsets[which];
+}
@@ -0,0 +1,87 @@
+/*
+ *  **************************************************************************
+ *  Copyright 2026 Shuai Cheng Li and Yen Kaow Ng
+ *  **************************************************************************
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  **************************************************************************
+ * 
+ */
+
+
+#ifndef _DISK_ADJACENCY_
+#define _DISK_ADJACENCY_
+
+#include <stdio.h>
+#include <vector>
+
+#include "MappedFile.h"
+
+using namespace std;
+
+
+/**
+ * Neighbor lists kept in a scratch file, for when they do not fit into
+ * memory (DISK mode).
+ *
+ * While the neighbors are being found, add() collects them in a buffer of
+ * bounded size. Whenever the buffer is full it is sorted by decoy and
+ * written to the scratch file as a block. finish() merges the blocks into
+ * one list per decoy and maps the result back into memory, after which
+ * list() gives the neighbors of a decoy in the order they were added.
+ */
+class DiskAdjacency
+{
+public:
+    static char * scratchDir; // where the scratch files go
+
+    struct Entry
+    {
+        int n;   // the neighbor
+        float d; // its distance
+    };
+
+private:
+    struct Record
+    {
+        int which;
+        Entry e;
+    };
+
+    int mNumDecoys;
+    size_t mMaxBuffered;       // most records kept in memory
+    vector<Record> mBuffer;
+    vector<size_t> mBlockEnds; // in records, within the block file
+    size_t * mOffsets;         // in entries, of each list in the list file
+    char * mBlockFileName;
+    char * mListFileName;
+    FILE * mBlockFile;
+    MappedFile * mLists;
+
+    void flush();
+
+public:
+    // A new name of a scratch file (to free()), unique to owner
+    static char * scratchFileName(const void * owner, const char * suffix);
+
+    DiskAdjacency(int numDecoys, double bufferBytes);
+    ~DiskAdjacency();
+    void add(int which, int n, float d);
+    void finish();
+    int size(int which);
+    const Entry * list(int which);
+};
+
+#endif
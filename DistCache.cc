@@ -0,0 +1,162 @@
+/*
+ *  **************************************************************************
+ *  Copyright 2026 Shuai Cheng Li and Yen Kaow Ng
+ *  **************************************************************************
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  **************************************************************************
+ * 
+ */
+
+
+#include <iostream>
+
+#include "DistCache.h"
+
+using namespace std;
+
+#define _EMPTY_KEY_ (~0ULL)
+
+
+static unsigned long long
+_key(int i, int j)
+{
+    if (i > j)
+    {
+        int t = i;
+        i = j;
+        j = t;
+    }
+    return ((unsigned long long) i << 32) | (unsigned int) j;
+}
+
+
+/**
+ * Allocate as many sets as fit into maxBytes. The number of sets is kept
+ * at a power of two so that a set can be found by masking.
+ */
+DistCache::DistCache(double maxBytes)
+{
+    double bytesPerSet = DIST_CACHE_WAYS * bytesPerEntry();
+    mNumSets = 1;
+    while (2 * mNumSets * bytesPerSet <= maxBytes)
+        mNumSets *= 2;
+
+    mSlots = new Slot[mNumSets * DIST_CACHE_WAYS];
+    for (size_t s=0; s < mNumSets * DIST_CACHE_WAYS; s++)
+    {
+        mSlots[s].key = _EMPTY_KEY_;
+        mSlots[s].referenced = 0;
+    }
+    mHands = new unsigned char[mNumSets];
+    for (size_t s=0; s < mNumSets; s++)
+        mHands[s] = 0;
+
+    mLookups = 0;
+    mHits = 0;
+    mEvictions = 0;
+}
+
+DistCache::~DistCache()
+{
+    delete [] mSlots;
+    delete [] mHands;
+}
+
+size_t
+DistCache::setOf(unsigned long long key)
+{
+    // Fibonacci hashing. The high bits are the well mixed ones
+    unsigned long long h = key * 0x9E3779B97F4A7C15ULL;
+    return (size_t) (h >> 32) & (mNumSets - 1);
+}
+
+/**
+ * Look up the distance between decoys i and j
+ */
+bool
+DistCache::get(int i, int j, float& dist)
+{
+    unsigned long long key = _key(i, j);
+    Slot * set = mSlots + setOf(key) * DIST_CACHE_WAYS;
+    mLookups++;
+    for (int w=0; w < DIST_CACHE_WAYS; w++)
+        if (set[w].key == key)
+        {
+            set[w].referenced = 1;
+            dist = set[w].dist;
+            mHits++;
+            return true;
+        }
+    return false;
+}
+
+/**
+ * Remember the distance between decoys i and j, evicting another pair of
+ * the same set if necessary
+ */
+void
+DistCache::put(int i, int j, float dist)
+{
+    unsigned long long key = _key(i, j);
+    size_t s = setOf(key);
+    Slot * set = mSlots + s * DIST_CACHE_WAYS;
+    for (int w=0; w < DIST_CACHE_WAYS; w++)
+        if (set[w].key == _EMPTY_KEY_ || set[w].key == key)
+        {
+            set[w].key = key;
+            set[w].dist = dist;
+            set[w].referenced = 0;
+            return;
+        }
+
+    // Set is full. Sweep for a slot not referenced since the last sweep
+    unsigned char hand = mHands[s];
+    while (set[hand].referenced)
+    {
+        set[hand].referenced = 0;
+        hand = (hand + 1) % DIST_CACHE_WAYS;
+    }
+    set[hand].key = key;
+    set[hand].dist = dist;
+    mHands[s] = (hand + 1) % DIST_CACHE_WAYS;
+    mEvictions++;
+}
+
+/**
+ * Number of distances the cache can hold
+ */
+double
+DistCache::capacity()
+{
+    return (double) mNumSets * DIST_CACHE_WAYS;
+}
+
+/**
+ * Memory taken by each distance the cache can hold
+ */
+double
+DistCache::bytesPerEntry()
+{
+    return sizeof(Slot) + 1. / DIST_CACHE_WAYS; // slot, and share of hand
+}
+
+void
+DistCache::showStats()
+{
+    cout << "Distance cache: " << mLookups << " lookups, " << mHits
+         << " hits (" << (mLookups? 100.*mHits/mLookups: 0.) << "%), "
+         << mEvictions << " evictions" << endl;
+}
@@ -0,0 +1,76 @@
+/*
+ *  **************************************************************************
+ *  Copyright 2026 Shuai Cheng Li and Yen Kaow Ng
+ *  **************************************************************************
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  **************************************************************************
+ * 
+ */
+
+
+#ifndef _DIST_CACHE_
+#define _DIST_CACHE_
+
+#include <stddef.h>
+
+// Number of slots per set. A pair can only be stored in the slots of its set
+#define DIST_CACHE_WAYS 8
+
+
+/**
+ * A fixed-size cache of computed distances between pairs of decoys.
+ *
+ * In MATRIX mode the AdjacentLists remember every computed distance, but in
+ * LIST mode they do not, so the same pair is otherwise recomputed in
+ * initRef(), auxClustering() and buildAdjacentLists().
+ *
+ * The pair (i,j) is stored under the key (min(i,j), max(i,j)) in one of the
+ * DIST_CACHE_WAYS slots of the set the key hashes to. When all slots of a
+ * set are taken, a slot is reclaimed with the clock algorithm: the set's
+ * hand sweeps the slots, clearing the referenced bit of recently used ones,
+ * and evicts the first slot whose bit is already clear.
+ */
+class DistCache
+{
+private:
+    struct Slot
+    {
+        unsigned long long key;
+        float dist;
+        unsigned int referenced;
+    };
+
+    Slot * mSlots;
+    unsigned char * mHands; // clock hand of each set
+    size_t mNumSets;
+
+    size_t setOf(unsigned long long key);
+
+public:
+    unsigned long mLookups;
+    unsigned long mHits;
+    unsigned long mEvictions;
+
+    DistCache(double maxBytes);
+    ~DistCache();
+    bool get(int i, int j, float& dist);
+    void put(int i, int j, float dist);
+    double capacity();
+    static double bytesPerEntry();
+    void showStats();
+};
+
+#endif
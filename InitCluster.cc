@@ -23,18 +23,29 @@
 
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <iomanip>
+#include <sstream>
 #include <math.h>
 #include <assert.h>
 #include <time.h>
+#include <algorithm>
+#include <random>
+#include <unordered_map>
 #ifndef __WIN32__
 #include <sys/resource.h>
+#include <unistd.h>
+#else
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
 #endif
 
 using namespace std;
 
 #include "InitCluster.h"
 #include "PreloadedPDB.h"
+#include "Prefetcher.h"
 #include "rmsd.h"
 
 // LIST, MATRIX, or LITE (in LITE mode, the AdjacentLists are actually empty)
@@ -43,6 +54,9 @@ ADJ_LIST_MODE AdjacentList::mListMode = MATRIX;
 #else
 ADJ_LIST_MODE AdjacentList::mListMode = LITE;
 #endif
+DiskAdjacency* AdjacentList::mDisk = NULL;
+int* AdjacentList::mMultiplicity = NULL;
+vector<Checkpoint::Entry>* AdjacentList::mLog = NULL;
 
 #ifndef _USE_FAST_RMSD_
 extern double rmsfit_(int *, double *, double *);
@@ -62,10 +76,19 @@ bool Clustering::OUTPUT_ALL = false;
 float Clustering::xPercentile = DEFAULT_PERCENTILE_FOR_THRESHOLD;
 bool Clustering::autoAdjustPercentile = true;
 float Clustering::xFactor = 2./3;
+double Clustering::MEM_LIMIT = 0;
+bool Clustering::COLLAPSE = false;
+float Clustering::COLLAPSE_RMSD = 0;
 
 
 //- = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = -
 
+static double
+_MB(double bytes)
+{
+    return bytes / (1024*1024);
+}
+
 #ifndef __WIN32__
 static double
 __timeval_difference(struct timeval * x, struct timeval * y)
@@ -114,10 +137,12 @@ _get_elapsed(int set_start)
 // We have two representation if AdjacentList;
 // one is list, the other is matrix (arrays), the latter is used when the input
 // size is small
+// When even the list does not fit into memory (DISK mode), the neighbors are
+// written to mDisk, and the AdjacentList only counts them.
 // Each AdjacentList contains all the neighbors of a decoy.
 // It is similar to the "neighbors" variable in cluster_info_silent.c.
 
-// for LIST mode
+// for LIST and DISK mode
 AdjacentList::AdjacentList()
 {
     mWhich = 0;
@@ -125,6 +150,7 @@ AdjacentList::AdjacentList()
     dist = new vector<float>(0);
     mReverseIndex = NULL; // not used
     mNumNeigh = 0;
+    mSize = 0;
 }
 
 // for MATRIX mode
@@ -138,6 +164,7 @@ AdjacentList::AdjacentList(int which, int size)
     for (int i=0; i < size; i++)
         (*dist)[i] = _OVER_RMSD_;
     mNumNeigh = 0;
+    mSize = 0;
 }
 
 AdjacentList::~AdjacentList()
@@ -151,7 +178,7 @@ AdjacentList::~AdjacentList()
 float
 AdjacentList::getD(int which)
 {
-    if (mListMode == LIST
+    if (mListMode == LIST || mListMode == DISK
 #ifdef _ADD_LITE_MODE_
            || mListMode == LITE
 #endif
@@ -166,31 +193,49 @@ AdjacentList::add(int n, float d, bool ifNeigh)
 #ifdef _ADD_LITE_MODE_
     if (mListMode == LITE) return;
 #endif
-    if (mListMode != LIST)
+    if (mListMode == MATRIX)
         (*dist)[n] = d;
     if (ifNeigh)
     {
+        if (mLog)
+        {
+            Checkpoint::Entry e = { mWhich, n, d };
+            mLog->push_back(e);
+        }
         if (mListMode == LIST)
         {
             neigh->push_back(n);
             dist->push_back(d);
         }
+        else if (mListMode == DISK)
+        {
+            mDisk->add(mWhich, n, d);
+        }
         else
         {
             (*neigh)[mNumNeigh] = n;
             mReverseIndex[n] = mNumNeigh;
         }
         mNumNeigh++;
+        mSize += weight(n);
     }
 }
 
-// Used only in LITE mode
+// Used only in LITE mode, where num is the decoys the neighbors stand for
 void
 AdjacentList::add(int num)
 {
 #ifdef _ADD_LITE_MODE_
     if (mListMode == LITE)
+    {
+        if (mLog)
+        {
+            Checkpoint::Entry e = { mWhich, num, 0 };
+            mLog->push_back(e);
+        }
         mNumNeigh += num;
+        mSize += num;
+    }
 #endif
 }
 
@@ -217,6 +262,7 @@ AdjacentList::remove(int n)
         (*dist)[i] = (*dist)[mNumNeigh-1];
         (*dist).pop_back();
         mNumNeigh--;
+        mSize -= weight(n);
     }
     else
     {
@@ -228,6 +274,7 @@ AdjacentList::remove(int n)
         (*neigh)[index] = last;
         mReverseIndex[last] = index;
         mNumNeigh--;
+        mSize -= weight(n);
         if (mNumNeigh < 0)
         {
            cout << "OMG" << endl;
@@ -295,6 +342,28 @@ Stru::dist(float x, float y, float z)
 Clustering::Clustering()
 {
     mLen = 0;
+    mNumPDB = 0;
+    mNames = NULL;
+    mIDs = NULL;
+    mPDBs = NULL;
+    mCluCen = NULL;
+    mAuxCluster = NULL;
+    mD2C = NULL;
+    mCen = NULL;
+    mNumNeighbor = NULL;
+    mAdjacentList = NULL;
+    mReference = NULL;
+    mFinalClusters = NULL;
+    mRemainingList = NULL;
+    mRemainingListIndex = NULL;
+    mDistCache = NULL;
+    mDiskAdjacency = NULL;
+    mIndex = NULL;
+    mCache = NULL;
+    mCheckpoint = NULL;
+    mMultiplicity = NULL;
+    mSelection = NULL;
+    mPercentile = xPercentile;
     spaceAllocatedForRMSD = false;
     bestClusMargin = 1.; // should be a value that will not trigger re-cluster
 #ifdef _SPICKER_SAMPLING_
@@ -304,14 +373,64 @@ Clustering::Clustering()
     cout << setprecision(5);
 }
 
+/**
+ * Free what cluster() (or an initialize() which took the clusters from the
+ * cache) leaves, so that another set of decoys (e.g. of another selection)
+ * can be clustered in its place. The decoy names are not freed, as they
+ * belong to SimPDB::decoyNames.
+ */
+Clustering::~Clustering()
+{
+    if (AdjacentList::mListMode == DISK && mFinalClusters) // loaded from disk
+        for (unsigned i=0; i < mFinalClusters->size(); i++)
+            delete (*mFinalClusters)[i];
+    delete mFinalClusters;
+    for (int i=0; i < mNumPDB; i++)
+    {
+        delete mAdjacentList[i];
+        delete mAuxCluster[i];
+        delete (*mPDBs)[i];
+    }
+    delete [] mAdjacentList;
+    delete [] mAuxCluster;
+    delete mCluCen;
+    delete [] mD2C;
+    delete [] mCen;
+    delete [] mReference;
+    delete [] mRemainingList;
+    delete [] mRemainingListIndex;
+    delete [] mNumNeighbor;
+    delete [] mMultiplicity;
+    AdjacentList::mMultiplicity = NULL;
+    delete mDistCache;
+    delete mDiskAdjacency;
+    AdjacentList::mDisk = NULL;
+    delete mIndex;
+    delete mCache;
+    delete mCheckpoint;
+    delete mPDBs;
+    delete mNames;
+    delete mIDs;
+    if (spaceAllocatedForRMSD)
+    {
+#ifdef _USE_FAST_RMSD_
+        delete [] result_coords;
+#endif
+        free(coord1);
+        free(coord2);
+    }
+}
+
 /**
  * Main aim:
  * (1) read decoys into mNames and mPDBs.
  * (2) decide THRESHOLD, CLUS_RADIUS
  * (3) initialize data structure needed for auxiliary grouping, and
  * (4) ...for clustering.
+ * Returns false, having shown the clusters, if they are taken from the
+ * cache (see ResultCache), in which case there is nothing to cluster.
  */
-void
+bool
 Clustering::initialize(char * filename, float threshold)
 {
     mInputFileName = filename;
@@ -333,7 +452,9 @@ Clustering::initialize(char * filename, float threshold)
         cout << "'" << *c << "'" << (*(c+1)=='\0'? "": ", ");
     cout << " in PDB files" << endl;
 
-    getThresholdAndDecoys();
+    if (!getThresholdAndDecoys())
+        return false;
+    setMultiplicity();
 
     CLU_RADIUS = THRESHOLD / 2.0 - 0.00001;
 
@@ -346,8 +467,23 @@ Clustering::initialize(char * filename, float threshold)
 
     cout << "Use of SCUD's bound " << (_use_scud_? "on": "off") << endl;
 
+    // What is derived from the decoys of a pack file may be in its index
+    if (filetype(mInputFileName) == PACK_FILE)
+        mIndex = new PackIndex(mInputFileName, *mIDs, mLen);
+
     if (_use_scud_)
-        realignDecoys(0);
+    {
+        const float * coords = mIndex? mIndex->coords(): NULL;
+        if (coords)
+        {
+            for (int i=0; i < mNumPDB; i++)
+                memcpy((*mPDBs)[i]->mCAlpha, coords + (size_t) 3*mLen*i,
+                       3*mLen*sizeof(float));
+            cout << "Realigned decoys taken from the index" << endl;
+        }
+        else
+            realignDecoys(0);
+    }
 
     if (EST_THRESHOLD == USER_SPECIFIED)
         cout << "Using user specified threshold: " << THRESHOLD << endl;
@@ -375,16 +511,7 @@ Clustering::initialize(char * filename, float threshold)
     {
 #endif
         // auto-switch between LIST and MATRIX mode
-        if (mNumPDB > _MATRIX_MODE_LIMIT_)
-        {
-            cout << "Using LIST mode" << endl;
-            AdjacentList::mListMode = LIST;
-        }
-        else
-        {
-            cout << "Using MATRIX mode" << endl;
-            AdjacentList::mListMode = MATRIX;
-        }
+        chooseListMode();
 #ifdef _ADD_LITE_MODE_
     }
     else
@@ -406,6 +533,7 @@ Clustering::initialize(char * filename, float threshold)
             mAdjacentList[i]->mWhich = i;
         }
     }
+    return true;
 }
 
 
@@ -415,6 +543,7 @@ Clustering::initialize(char * filename, float threshold)
  */
 void
 Clustering::reinitialize(vector<char *> * nNames,
+                         vector<int> * nIDs,
                          vector<Stru *> * nPDBs,
                          float threshold)
 {
@@ -424,9 +553,11 @@ Clustering::reinitialize(vector<char *> * nNames,
 
     CLU_RADIUS = THRESHOLD / 2.0 - 0.00001;
     mNames = nNames;
+    mIDs = nIDs;
     mPDBs = nPDBs;
     int _mNumPDB = mNumPDB;
     mNumPDB = mPDBs->size();
+    setMultiplicity();
 
     // Initialize auxiliary decoys grouping - = - = - = - = -
 
@@ -450,11 +581,18 @@ Clustering::reinitialize(vector<char *> * nNames,
     // Initialize clustering - = - = - = - = - = - = - = - = -
 
     // delete old...
+    if (AdjacentList::mListMode == DISK) // clusters were loaded from disk
+        for (unsigned i=0; i < mFinalClusters->size(); i++)
+            delete (*mFinalClusters)[i];
     for (int i=0; i < _mNumPDB; i++)
         delete mAdjacentList[i];
     delete mAdjacentList;
 
-    // ...create new
+    // ...create new, in the mode that suits the new number of decoys
+#ifdef _ADD_LITE_MODE_
+    if (AdjacentList::mListMode != LITE)
+#endif
+        chooseListMode();
     mAdjacentList = new AdjacentList*[mNumPDB];
     for (int i=0; i < mNumPDB; i++)
     {
@@ -479,12 +617,131 @@ Clustering::reinitialize(vector<char *> * nNames,
 
 
 /**
- * Get these: mNames, mPDBs, mLen
+ * The options (other than the decoys) which the threshold estimated
+ * depends on, as the key of the threshold in the cache
  */
-void
+string
+Clustering::thresholdOptions()
+{
+    ostringstream options;
+    options << "threshold by " << EST_THRESHOLD << " x " << xFactor
+            << " percentile ";
+    if (autoAdjustPercentile)
+        options << "auto";
+    else
+        options << xPercentile;
+    options << " filtering " << FILTER_MODE << " " << SimPDB::selection_key();
+    if (mSelection)
+        options << " selection " << mSelection->name << ":"
+                << mSelection->s_residue << "," << mSelection->e_residue
+                << ":" << mSelection->chains;
+    if (COLLAPSE)
+        options << " collapse " << COLLAPSE_RMSD;
+    return options.str();
+}
+
+/**
+ * The options which the clusters shown depend on, as their key in the
+ * cache
+ */
+string
+Clustering::clusterOptions()
+{
+    ostringstream options;
+    options << thresholdOptions();
+    if (EST_THRESHOLD == USER_SPECIFIED)
+        options << " threshold " << setprecision(9) << THRESHOLD;
+    options << " all " << OUTPUT_ALL
+            << " lite " << (AdjacentList::mListMode == LITE);
+    return options.str();
+}
+
+
+/**
+ * Get these: mNames, mIDs, mPDBs, mLen
+ * Returns false, having shown the clusters, if they are in the cache.
+ */
+bool
 Clustering::getThresholdAndDecoys()
 {
-    readDecoyNames(); // results in mNames
+    readDecoyNames(); // results in mNames and mIDs
+
+    // take the clusters, or the threshold, from the cache - = - = - = -
+
+    EST_THRESHOLD_MODE strategy = EST_THRESHOLD;
+    bool streaming = SimPDB::preloadPDB && SimPDB::preloadedPDB->streaming();
+    if (streaming && (ResultCache::directory || Checkpoint::fileName))
+        cout << "Clustering of a decoy stream is not cached or checkpointed"
+             << endl;
+    if (ResultCache::directory && !streaming)
+    {
+        mCache = new ResultCache(*mIDs, *mNames, thresholdOptions(),
+                                 clusterOptions());
+        string clusters;
+        if (mCache->clusters(&clusters))
+        {
+            cout << "Clusters taken from the cache" << endl << clusters;
+            return false;
+        }
+        if (strategy != USER_SPECIFIED && mCache->threshold(&THRESHOLD))
+        {
+            cout << "Threshold = " << THRESHOLD
+                 << " (taken from the cache)" << endl;
+            strategy = USER_SPECIFIED;
+        }
+    }
+
+    // or resume from a checkpoint of the clustering - = - = - = - = -
+
+    if (Checkpoint::fileName && !streaming)
+    {
+        string filename = Checkpoint::fileName;
+        if (mSelection)
+            filename += string(".") + mSelection->name;
+        mCheckpoint = new Checkpoint(filename.c_str(),
+                                     string(mInputFileName) + ", "
+                                         + clusterOptions(),
+                                     mNames->size(),
+                                     AdjacentList::mListMode == LITE);
+        if (strategy != USER_SPECIFIED && mCheckpoint->threshold(&THRESHOLD))
+        {
+            cout << "Threshold = " << THRESHOLD
+                 << " (taken from the checkpoint)" << endl;
+            strategy = USER_SPECIFIED;
+        }
+    }
+
+    // decide the min max thresholds - = - = - = - = -
+
+    float minDist, maxDist, mostFreqDist, xPercentileDist;
+
+    if (strategy == EST_THRESHOLD) // not taken from the cache
+        estimateDist(mIDs,
+                     NUM_TRIALS_FOR_THRESHOLD,
+                     mNames->size() > 2*RANDOM_DECOY_SIZE_FOR_THRESHOLD?
+                         RANDOM_DECOY_SIZE_FOR_THRESHOLD: (mNames->size()/2),
+                     mPercentile,
+                     &minDist,
+                     &maxDist,
+                     &mostFreqDist,
+                     &xPercentileDist);
+
+    // The threshold range of a decoy stream is estimated from its first
+    // decoys, while the rest are still arriving. Now take in the rest
+    PreloadedPDB * pdbs = SimPDB::preloadedPDB;
+    if (SimPDB::preloadPDB && pdbs->streaming())
+    {
+        pdbs->loadStream(0);
+        for (int i=mNames->size(); i < pdbs->mNames->size(); i++)
+        {
+            mNames->push_back((*pdbs->mNames)[i]);
+            mIDs->push_back(i);
+        }
+        cout << "Read " << mNames->size() << " decoy names" << endl;
+    }
+
+    if (COLLAPSE)
+        collapseDecoys();
 
     // decide min max target cluster sizes - = - = - = -
 
@@ -503,21 +760,7 @@ Clustering::getThresholdAndDecoys()
     if (targetClusterSize > (mNames->size()-1))
         targetClusterSize = mNames->size()-1;
 
-    // decide the min max thresholds - = - = - = - = -
-
-    float minDist, maxDist, mostFreqDist, xPercentileDist;
-
-    estimateDist(mNames,
-                 NUM_TRIALS_FOR_THRESHOLD,
-                 mNames->size() > 2*RANDOM_DECOY_SIZE_FOR_THRESHOLD?
-                     RANDOM_DECOY_SIZE_FOR_THRESHOLD: (mNames->size()/2),
-                 xPercentile,
-                 &minDist,
-                 &maxDist,
-                 &mostFreqDist,
-                 &xPercentileDist);
-
-    if (EST_THRESHOLD == MOST_FREQ_BASED)
+    if (strategy == MOST_FREQ_BASED)
     {
         THRESHOLD = minDist + xFactor * (mostFreqDist-minDist) ;
         cout << "Finding threshold using most frequent distance" << endl;
@@ -526,15 +769,15 @@ Clustering::getThresholdAndDecoys()
              << " - " << minDist << ") )" << endl;
     }
 
-    if (EST_THRESHOLD == PERCENT_EDGES)
+    if (strategy == PERCENT_EDGES)
     {
         THRESHOLD = xPercentileDist;
-        cout << "Finding threshold to keep " << xPercentile
+        cout << "Finding threshold to keep " << mPercentile
              << "%% edges" << endl;
         cout << "Threshold = " << THRESHOLD << endl;
     }
 
-    if (EST_THRESHOLD == MIN_AVG_DIST_BASED)
+    if (strategy == MIN_AVG_DIST_BASED)
     {
         // Uses a set of randomly chosen decoys to estimate the threshold
         // as in cluster_info_silent (i.e. rosetta)
@@ -549,12 +792,12 @@ Clustering::getThresholdAndDecoys()
         clock_t start = clock();
 
         int numDecoys = mNames->size() > 101? 101: mNames->size();
-        vector<char *>* names = getRandomDecoyNames(mNames, numDecoys, 0);
-        vector<Stru *>* decoys = readDecoys(names);
+        vector<int>* ids = getRandomDecoyIDs(mIDs, numDecoys, 0);
+        vector<Stru *>* decoys = readDecoys(ids);
 
-        float ** nbors = getNborList(decoys, mNames, mNames->size()-1);
+        float ** nbors = getNborList(decoys, mIDs, mNames->size()-1);
 
-        destroyRandomDecoys(names, decoys);
+        destroyRandomDecoys(ids, decoys);
 
         // find the minimum of average distances
         float avg_dist, min_avg_dist = _OVER_RMSD_;
@@ -579,7 +822,7 @@ Clustering::getThresholdAndDecoys()
              << " + " << xFactor << " * " << min_avg_dist << ")" << endl;
     }
 
-    if (EST_THRESHOLD == SAMPLED_ROSETTA)
+    if (strategy == SAMPLED_ROSETTA)
     {
         // Uses a set of randomly chosen decoys to estimate the threshold
         // as in cluster_info_silent (i.e. rosetta)
@@ -606,12 +849,12 @@ Clustering::getThresholdAndDecoys()
         clock_t start = clock();
 
         int numDecoys = mNames->size() > 101? 101: mNames->size();
-        vector<char *>* names = getRandomDecoyNames(mNames, numDecoys, 0);
-        vector<Stru *>* decoys = readDecoys(names);
+        vector<int>* ids = getRandomDecoyIDs(mIDs, numDecoys, 0);
+        vector<Stru *>* decoys = readDecoys(ids);
 
-        float ** nbors = getNborList(decoys, mNames, maxClusterSize);
+        float ** nbors = getNborList(decoys, mIDs, maxClusterSize);
 
-        destroyRandomDecoys(names, decoys);
+        destroyRandomDecoys(ids, decoys);
 
         float minThreshold = minDist;
         float maxThreshold = (minDist + maxDist)/2;
@@ -629,30 +872,47 @@ Clustering::getThresholdAndDecoys()
              << ". Found in " << elapsed << " s" << endl;
     }
 
+    if (mCheckpoint && strategy != ROSETTA) // else known only below
+        mCheckpoint->putThreshold(THRESHOLD);
+
     // read decoys - = - = - = - = - = - = - = - = -
 
-    vector<char *>* randNames;
-    vector<Stru *>* randDecoys;
-    if (FILTER_MODE)
+    // those kept by filtering before the clustering was stopped, if it was
+    const vector<int> * kept = mCheckpoint? mCheckpoint->decoys(): NULL;
+    if (kept)
+    {
+        cout << "Decoys kept by filtering taken from the checkpoint" << endl;
+        *mIDs = *kept;
+        mNames->clear();
+        for (int i=0; i < mIDs->size(); i++)
+            mNames->push_back((*SimPDB::decoyNames)[(*mIDs)[i]]);
+    }
+
+    bool filter = FILTER_MODE && kept == NULL;
+    vector<int>* randIDs = NULL;
+    vector<Stru *>* randDecoys = NULL;
+    if (filter)
     {
         int numDecoys = mNames->size() > 2*RANDOM_DECOY_SIZE_FOR_FILTERING?
                         RANDOM_DECOY_SIZE_FOR_FILTERING: (mNames->size()/2);
-        randNames = getRandomDecoyNames(mNames, numDecoys, 0);
-        randDecoys = readDecoys(randNames);
+        randIDs = getRandomDecoyIDs(mIDs, numDecoys, 0);
+        randDecoys = readDecoys(randIDs);
     }
 
     clock_t start = clock();
-    readDecoys(randNames, randDecoys); // results in mPDBs
+    readDecoys(randIDs, randDecoys); // results in mPDBs
     double elapsed = (clock() - start)/(double)CLOCKS_PER_SEC;
     cout << "Decoys read in " << elapsed << " s" << endl;
 
-    if (FILTER_MODE)
-        destroyRandomDecoys(randNames, randDecoys);
+    if (filter)
+        destroyRandomDecoys(randIDs, randDecoys);
+    if (mCheckpoint)
+        mCheckpoint->putDecoys(*mIDs);
 
     // find threshold using ROSETTA mode - = - = - = - = - = - = - = - = -
     // (this has to be done with the full decoys) - = - = - = - = - = - =
 
-    if (EST_THRESHOLD == ROSETTA)
+    if (strategy == ROSETTA)
     {
         // This is exactly ROSETTA's way of getting threshold.
         // We add this in for comparison with the output of ROSETTA.
@@ -692,6 +952,11 @@ Clustering::getThresholdAndDecoys()
              << ". Found in " << elapsed << " s" << endl;
     }
 
+    if (mCache && strategy != USER_SPECIFIED)
+        mCache->setThreshold(THRESHOLD);
+    if (mCheckpoint)
+        mCheckpoint->putThreshold(THRESHOLD);
+    return true;
 }
 
 
@@ -706,7 +971,7 @@ Clustering::getThresholdAndDecoys()
  * is stated in randDecoySize.
  */
 void
-Clustering::estimateDist(vector<char *>* allNames,
+Clustering::estimateDist(vector<int>* allIDs,
                          int numTrials,
                          int randDecoySize,
                          float xPercent,
@@ -715,13 +980,13 @@ Clustering::estimateDist(vector<char *>* allNames,
                          float *mostFreqDist,
                          float *xPercentileDist)
 {
-    vector<char *>* randNames;
+    vector<int>* randIDs;
     vector<Stru *>* randDecoys;
 
     cout << "Estimating threshold range...";
 
-    randNames = getRandomDecoyNames(allNames, randDecoySize, 0);
-    randDecoys = readDecoys(randNames);
+    randIDs = getRandomDecoyIDs(allIDs, randDecoySize, 0);
+    randDecoys = readDecoys(randIDs);
 
     estimateDist(randDecoys,
                  xPercent,
@@ -730,7 +995,7 @@ Clustering::estimateDist(vector<char *>* allNames,
                  mostFreqDist,
                  xPercentileDist);
 
-    destroyRandomDecoys(randNames, randDecoys);
+    destroyRandomDecoys(randIDs, randDecoys);
 
 #ifdef _ANALYZE_RANDOM_SAMPLES_
     cout << endl
@@ -749,8 +1014,8 @@ Clustering::estimateDist(vector<char *>* allNames,
     float *xPercentileDists = new float[numTrials-1];
     for (int i=0; i < numTrials-1; i++)
     {
-        randNames = getRandomDecoyNames(allNames, randDecoySize, 1 + i*100);
-        randDecoys = readDecoys(randNames);
+        randIDs = getRandomDecoyIDs(allIDs, randDecoySize, 1 + i*100);
+        randDecoys = readDecoys(randIDs);
         estimateDist(randDecoys,
                      xPercent,
                      &minDists[i],
@@ -758,7 +1023,7 @@ Clustering::estimateDist(vector<char *>* allNames,
                      &mostFreqDists[i],
                      &xPercentileDists[i]);
 
-        destroyRandomDecoys(randNames, randDecoys);
+        destroyRandomDecoys(randIDs, randDecoys);
 
 #ifdef _ANALYZE_RANDOM_SAMPLES_
         cout << "sampling " << (i+2) << ": dist [" << minDists[i] << ","
@@ -799,12 +1064,57 @@ Clustering::estimateDist(vector<char *>* allNames,
 
 
 /**
- * Read from the input file the names of decoys
+ * The decoys loaded for all of SimPDB::selections, which each selection
+ * takes its atoms from
+ */
+static PreloadedPDB * _all_atoms = NULL;
+
+/**
+ * Take the atoms of a selection from the decoys loaded for all the
+ * selections, to be the decoys clustered. Returns their names.
+ */
+static vector<char *> *
+_select_atoms(NamedSelection * selection)
+{
+    if (_all_atoms == NULL)
+    {
+        if (!SimPDB::preloadPDB
+            || SimPDB::atomInfo.size() != SimPDB::preloadedPDB->mNumResidue)
+        {
+            cerr << "Selections need decoys in PDB or mmCIF format" << endl;
+            exit(0);
+        }
+        _all_atoms = SimPDB::preloadedPDB;
+    }
+    vector<int> atoms = selection->atoms(SimPDB::atomInfo);
+    if (atoms.empty())
+    {
+        cerr << "No atoms in selection \"" << selection->name << "\"" << endl;
+        exit(0);
+    }
+    PreloadedPDB * pdbs = new PreloadedPDB();
+    pdbs->loadAtoms(_all_atoms, atoms);
+    if (SimPDB::preloadedPDB != _all_atoms) // of the previous selection,
+        delete SimPDB::preloadedPDB;        // whose clustering is destroyed
+    SimPDB::preloadedPDB = pdbs;
+    cout << "Selection \"" << selection->name << "\" has " << atoms.size()
+         << " of the " << _all_atoms->mNumResidue << " atoms loaded" << endl;
+    return pdbs->mNames;
+}
+
+
+/**
+ * Read from the input file the names of decoys, and give every decoy an id.
+ * The names become SimPDB::decoyNames; mNames and mIDs start out listing
+ * all of them.
  */
 void
 Clustering::readDecoyNames()
 {
-    switch (filetype(mInputFileName))
+    vector<char *> * decoyNames = NULL;
+    if (mSelection && _all_atoms) // loaded for an earlier selection
+        decoyNames = _all_atoms->mNames;
+    else switch (filetype(mInputFileName))
     {
     PreloadedPDB * pdbs;
     case SILENT_FILE:
@@ -812,54 +1122,303 @@ Clustering::readDecoyNames()
         pdbs->loadSilentFile(mInputFileName); // Preload PDBs from silent file
         SimPDB::preloadedPDB = pdbs; // Attach the preloaded PDBs to SimPDB
         SimPDB::preloadPDB = true;
-        mNames = pdbs->mNames;
-        cout << "Read " << mNames->size() << " decoy names" << endl;
-        return;
+        decoyNames = pdbs->mNames;
+        break;
+    case PACK_FILE:
+        pdbs = new PreloadedPDB();
+        pdbs->loadPackFile(mInputFileName); // Map PDBs from pack file
+        SimPDB::preloadedPDB = pdbs; // Attach the preloaded PDBs to SimPDB
+        SimPDB::preloadPDB = true;
+        decoyNames = pdbs->mNames;
+        break;
+    case PDB_FILE:
+        pdbs = new PreloadedPDB();
+        pdbs->loadPDBFile(mInputFileName); // Preload the models of the file
+        SimPDB::preloadedPDB = pdbs; // Attach the preloaded PDBs to SimPDB
+        SimPDB::preloadPDB = true;
+        decoyNames = pdbs->mNames;
+        break;
+    case TRAJECTORY_FILE:
+        pdbs = new PreloadedPDB();
+        pdbs->loadTrajectory(mInputFileName); // Preload the frames
+        SimPDB::preloadedPDB = pdbs; // Attach the preloaded PDBs to SimPDB
+        SimPDB::preloadPDB = true;
+        decoyNames = pdbs->mNames;
+        break;
+    case TAR_FILE:
+        pdbs = new PreloadedPDB();
+        pdbs->loadTarFile(mInputFileName); // Preload the archived decoys
+        SimPDB::preloadedPDB = pdbs; // Attach the preloaded PDBs to SimPDB
+        SimPDB::preloadPDB = true;
+        decoyNames = pdbs->mNames;
+        break;
+    case DECOY_STREAM:
+        // Only the first decoys are waited for; the rest are taken in once
+        // the threshold range is estimated (see getThresholdAndDecoys).
+        // Selections are taken from all of them, so they are waited for
+        pdbs = new PreloadedPDB();
+        pdbs->loadStream(SimPDB::selections.empty()? STREAM_SAMPLE_DECOYS: 0);
+        SimPDB::preloadedPDB = pdbs; // Attach the preloaded PDBs to SimPDB
+        SimPDB::preloadPDB = true;
+        decoyNames = pdbs->mNames;
+        break;
     case PDB_LIST:
-        if (SimPDB::preloadPDB)
+        if (SimPDB::multiModel) // models can only be read by preloading
+            SimPDB::preloadPDB = true;
+        else if (SimPDB::preloadPDB)
         {
             unsigned int numDecoys = num_lines_in_file(mInputFileName);
-            if (numDecoys > PreloadedPDB::ADVISED_THRESHOLD)
+            int len = num_residues_in_first_decoy(mInputFileName);
+            double needed = decoysFootprint(numDecoys, len);
+            cout << "Preloading " << numDecoys << " decoys of " << len
+                 << " atoms needs " << _MB(needed) << " MB (limit "
+                 << _MB(getMemLimit()) << " MB)" << endl;
+            if (needed > getMemLimit())
             {
-                cout << "More than " << PreloadedPDB::ADVISED_THRESHOLD
-                     << " decoys: not preloading PDBs" << endl;
+                cout << "Memory limit exceeded: not preloading PDBs" << endl;
                 SimPDB::preloadPDB = false;
             }
         }
         if (!SimPDB::preloadPDB) // either switched off by user, or by above
+        {
+            // Read each decoy file only once, into a scratch file which all
+            // of the phases take the decoys from
+            pdbs = new PreloadedPDB();
+            if (!pdbs->spillPDBFromList(mInputFileName))
+            {
+                cout << "Reading decoy files as they are needed" << endl;
+                break;
+            }
+            SimPDB::preloadedPDB = pdbs;
+            SimPDB::preloadPDB = true;
+            decoyNames = pdbs->mNames;
             break;
+        }
         pdbs = new PreloadedPDB();
         pdbs->loadPDBFromList(mInputFileName); // Preload PDBs from pdb list
         SimPDB::preloadedPDB = pdbs; // Attach the preloaded PDBs to SimPDB
-        mNames = pdbs->mNames;
-        cout << "Read " << mNames->size() << " decoy names" << endl;
-        return;
-    default:
+        decoyNames = pdbs->mNames;
         break;
+    default:
+        cerr << "Unknown file type of \"" << mInputFileName << "\"" << endl;
+        exit(0);
     }
 
-    ifstream input(mInputFileName);
-    if (!input)
+    if (decoyNames == NULL) // names are to be read from the list
     {
-        cerr << "Cannot find file \"" << mInputFileName << "\"" << endl;
-        exit(0);
+        ifstream input(mInputFileName);
+        if (!input)
+        {
+            cerr << "Cannot find file \"" << mInputFileName << "\"" << endl;
+            exit(0);
+        }
+
+        char buf[400];
+        char* token;
+
+        decoyNames = new vector<char *>(0);
+        while (!input.eof())
+        {
+            input.getline(buf, 400);
+            if (input.fail() && !input.eof()) // skip the rest of a long line
+            {
+                input.clear();
+                input.ignore(numeric_limits<streamsize>::max(), '\n');
+            }
+            token = strtok(buf, " ");
+            if(token == NULL) continue;
+            char* name = new char[strlen(token)+1];
+            strcpy(name, token);
+            decoyNames->push_back(name);
+        }
+        input.close();
     }
 
-    char buf[400];
-    char* token;
+    if (mSelection)
+        decoyNames = _select_atoms(mSelection);
+
+    SimPDB::decoyNames = decoyNames;
+    mNames = new vector<char *>(*decoyNames);
+    mIDs = new vector<int>(decoyNames->size());
+    for (int i=0; i < decoyNames->size(); i++)
+        (*mIDs)[i] = i;
+    cout << "Read " << mNames->size() << " decoy names" << endl;
+}
+
+
+/**
+ * Hash of the coordinates of a decoy (FNV-1a over their bytes)
+ */
+static size_t
+_coords_hash(const float * coords, int len)
+{
+    const unsigned char * p = (const unsigned char *) coords;
+    size_t h = 14695981039346656037ULL;
+    for (size_t i=0; i < 3*len*sizeof(float); i++)
+        h = (h ^ p[i]) * 1099511628211ULL;
+    return h;
+}
 
-    mNames = new vector<char *>(0);
-    while (!input.eof())
+
+/**
+ * Collapse the decoys whose coordinates are the same (or, when
+ * COLLAPSE_RMSD is given, within COLLAPSE_RMSD of each other) into one
+ * representative, which is then clustered with the multiplicity of all the
+ * decoys it stands for. The names of the collapsed decoys are kept in
+ * mCollapsed, under the id of their representative.
+ *
+ * Within COLLAPSE_RMSD, each decoy is compared only with the representatives
+ * whose radius of gyration is within COLLAPSE_RMSD of its own, since the
+ * RMSD of two decoys is at least the difference of their radii of gyration.
+ */
+void
+Clustering::collapseDecoys()
+{
+    if (!SimPDB::preloadPDB)
     {
-        input.getline(buf, 400);
-        token = strtok(buf, " ");
-        if(token == NULL) continue;
-        char* name = new char[strlen(token)+1];
-        strcpy(name, token);
-        mNames->push_back(name);
+        cout << "Decoys are not preloaded: not collapsing duplicates" << endl;
+        return;
     }
-    input.close();
-    cout << "Read " << mNames->size() << " decoy names" << endl;
+    clock_t start = clock();
+    PreloadedPDB * pdbs = SimPDB::preloadedPDB;
+    int len = pdbs->getSimPDB((*mIDs)[0])->mNumResidue;
+    int numDecoys = mIDs->size();
+
+    // Exact duplicates - = - = - = - = - = - = - = -
+    vector<bool> kept(numDecoys, true);
+    unordered_map<size_t, vector<int> > reps; // by hash, indices of kept
+    int numExact = 0;
+    for (int i=0; i < numDecoys; i++)
+    {
+        const float * coords = pdbs->getSimPDB((*mIDs)[i])->mCAlpha;
+        vector<int>& same = reps[_coords_hash(coords, len)];
+        int j;
+        for (j=0; j < same.size(); j++)
+        {
+            const float * other = pdbs->getSimPDB((*mIDs)[same[j]])->mCAlpha;
+            if (!memcmp(coords, other, 3*len*sizeof(float)))
+                break;
+        }
+        if (j == same.size())
+        {
+            same.push_back(i);
+            continue;
+        }
+        mCollapsed[(*mIDs)[same[j]]].push_back((*mNames)[i]);
+        kept[i] = false;
+        numExact++;
+    }
+
+    // Decoys within COLLAPSE_RMSD - = - = - = - = - =
+    int numNear = 0;
+    if (COLLAPSE_RMSD > 0)
+    {
+        vector<pair<float,int> > byRg; // radius of gyration, index
+        for (int i=0; i < numDecoys; i++)
+        {
+            if (!kept[i])
+                continue;
+            const float * coords = pdbs->getSimPDB((*mIDs)[i])->mCAlpha;
+            double sum = 0;
+            for (int k=0; k < 3*len; k++)
+                sum += coords[k]*coords[k];
+            byRg.push_back(make_pair((float) sqrt(sum/len), i));
+        }
+        sort(byRg.begin(), byRg.end());
+
+        double * c1 = new double[3*len];
+        double * c2 = new double[3*len];
+        vector<pair<float,int> > leaders; // in increasing radius of gyration
+        for (int n=0; n < byRg.size(); n++)
+        {
+            int i = byRg[n].second;
+            const float * coords = pdbs->getSimPDB((*mIDs)[i])->mCAlpha;
+            for (int k=0; k < 3*len; k++)
+                c1[k] = coords[k];
+            int l = lower_bound(leaders.begin(), leaders.end(),
+                        make_pair(byRg[n].first - COLLAPSE_RMSD, -1))
+                    - leaders.begin();
+            for (; l < leaders.size(); l++)
+            {
+                int leader = leaders[l].second;
+                const float * other =
+                    pdbs->getSimPDB((*mIDs)[leader])->mCAlpha;
+                for (int k=0; k < 3*len; k++)
+                    c2[k] = other[k];
+#ifdef _USE_FAST_RMSD_
+                double rmsd = fast_rmsd(c1, c2, len);
+                if (rmsd != rmsd) // crazy RMSD
+                    rmsd = RMSD(c1, c2, len);
+#else
+                double rmsd = RMSD(c1, c2, len);
+#endif
+                if (rmsd <= COLLAPSE_RMSD)
+                    break;
+            }
+            if (l == leaders.size())
+            {
+                leaders.push_back(byRg[n]);
+                continue;
+            }
+            // collapse i, and those collapsed into it, into the leader
+            vector<char *>& into = mCollapsed[(*mIDs)[leaders[l].second]];
+            into.push_back((*mNames)[i]);
+            map<int, vector<char *> >::iterator it =
+                mCollapsed.find((*mIDs)[i]);
+            if (it != mCollapsed.end())
+            {
+                into.insert(into.end(), it->second.begin(), it->second.end());
+                mCollapsed.erase(it);
+            }
+            kept[i] = false;
+            numNear++;
+        }
+        delete [] c1;
+        delete [] c2;
+    }
+
+    // Keep only the representatives - = - = - = - = -
+    int k = 0;
+    for (int i=0; i < numDecoys; i++)
+    {
+        if (!kept[i])
+            continue;
+        (*mNames)[k] = (*mNames)[i];
+        (*mIDs)[k] = (*mIDs)[i];
+        k++;
+    }
+    mNames->resize(k);
+    mIDs->resize(k);
+
+    double elapsed = (clock() - start)/(double)CLOCKS_PER_SEC;
+    cout << "Collapsed " << numExact << " duplicate decoys";
+    if (COLLAPSE_RMSD > 0)
+        cout << " and " << numNear << " decoys within " << COLLAPSE_RMSD;
+    cout << " into " << k << " decoys in " << elapsed << " s" << endl;
+}
+
+
+/**
+ * Set up the multiplicities of the decoys in mIDs from mCollapsed
+ */
+void
+Clustering::setMultiplicity()
+{
+    if (mMultiplicity)
+        delete [] mMultiplicity;
+    mMultiplicity = NULL;
+    if (!mCollapsed.empty())
+    {
+        mMultiplicity = new int[mIDs->size()];
+        for (int i=0; i < mIDs->size(); i++)
+        {
+            map<int, vector<char *> >::iterator it =
+                mCollapsed.find((*mIDs)[i]);
+            mMultiplicity[i] = it == mCollapsed.end()? 1:
+                               1 + it->second.size();
+        }
+    }
+    AdjacentList::mMultiplicity = mMultiplicity;
 }
 
 
@@ -881,19 +1440,21 @@ Clustering::allocateSpaceForRMSD(int len)
  * Read from the input files the decoys and return them
  */
 vector<Stru *>*
-Clustering::readDecoys(vector<char *>* decoynames)
+Clustering::readDecoys(vector<int>* decoyIDs)
 {
-    SimPDB* firstPDB = new SimPDB((*decoynames)[0]);
+    SimPDB* firstPDB = new SimPDB((*decoyIDs)[0]);
     mLen = firstPDB->mNumResidue;
 
     allocateSpaceForRMSD(mLen);
 
-    vector<Stru *> * decoys = new vector<Stru* >(decoynames->size());
+    vector<Stru *> * decoys = new vector<Stru* >(decoyIDs->size());
     (*decoys)[0] = new Stru(firstPDB, mLen);
 
-    for (int i=1; i < decoynames->size(); i++)
+    Prefetcher prefetcher(vector<int>(decoyIDs->begin()+1, decoyIDs->end()),
+                          mLen);
+    for (int i=1; i < decoyIDs->size(); i++)
     {
-        (*decoys)[i] = new Stru(new SimPDB((*decoynames)[i], mLen), mLen);
+        (*decoys)[i] = new Stru(prefetcher.next(), mLen);
     }
     return decoys;
 }
@@ -903,10 +1464,11 @@ Clustering::readDecoys(vector<char *>* decoynames)
  * Read from the input files all the decoys, filtering when necessary
  */
 void
-Clustering::readDecoys(vector<char *>* randomNames,
+Clustering::readDecoys(vector<int>* randomIDs,
                        vector<Stru *>* randomDecoys)
 {
     vector<char *>* newNames = new vector<char *>(0);
+    vector<int>* newIDs = new vector<int>(0);
     vector<Stru *>* newDecoys = new vector<Stru *>(0);
 #ifdef _SPICKER_SAMPLING_
     // Spicker samples decoys at a fixed interval delta
@@ -922,6 +1484,7 @@ Clustering::readDecoys(vector<char *>* randomNames,
          << " and filter mode " << (FILTER_MODE? "on": "off") << endl;
 
     int size = mNames->size();
+    vector<int> toRead; // indices of the decoys to read, in order
     for (int i=0; i < size; i++)
     {
 #ifdef _SPICKER_SAMPLING_
@@ -929,32 +1492,46 @@ Clustering::readDecoys(vector<char *>* randomNames,
             continue;
         sampled_decoy_id++;
 #endif
+        toRead.push_back(i);
+    }
+
+    Prefetcher * prefetcher = NULL; // once mLen is known
+    for (int k=0; k < toRead.size(); k++)
+    {
+        int i = toRead[k];
 #ifdef _SHOW_PERCENTAGE_COMPLETE_
         printf("Read %4.1f%%\r", 100.*i/size);
         fflush(stdout);
 #endif
         // read in the decoy's PDB
-        char* dName = (*mNames)[i];
+        int dID = (*mIDs)[i];
         Stru* s;
         if (mLen == 0)
         {
-            SimPDB* aPDB = new SimPDB(dName);
+            SimPDB* aPDB = new SimPDB(dID);
             mLen = aPDB->mNumResidue;
             s = new Stru(aPDB, mLen);
             allocateSpaceForRMSD(mLen);
         }
         else
         {
-            s = new Stru(new SimPDB(dName, mLen), mLen);
+            if (prefetcher == NULL)
+            {
+                vector<int> ids;
+                for (int j=k; j < toRead.size(); j++)
+                    ids.push_back((*mIDs)[toRead[j]]);
+                prefetcher = new Prefetcher(ids, mLen);
+            }
+            s = new Stru(prefetcher->next(), mLen);
         }
         bool isOutlier = false;
-        if (FILTER_MODE) // then we shall decide whether to include s
+        if (randomDecoys) // then we shall decide whether to include s
         {
             int randomDecoysSize = randomDecoys->size();
             isOutlier = true;
             for(int j=0; j < randomDecoysSize; j++)
             {
-                if (strcmp(dName,(*randomNames)[j]) == 0)
+                if (dID == (*randomIDs)[j])
                     continue;
                 if (_use_sig_ && estD(s,(*randomDecoys)[j]) > 2*THRESHOLD)
                     continue;
@@ -967,22 +1544,25 @@ Clustering::readDecoys(vector<char *>* randomNames,
         }
         if (!isOutlier)
         {
-            newNames->push_back(dName);
+            newNames->push_back((*mNames)[i]);
+            newIDs->push_back(dID);
             newDecoys->push_back(s);
         }
         else
         {
-            delete s;
-            delete [] dName;
+            delete s; // its name stays in SimPDB::decoyNames
         }
     }
+    delete prefetcher;
     cout << "Read " << newNames->size() << " decoys.";
-    if (FILTER_MODE)
+    if (randomDecoys)
         cout << " Filtered " << (mNames->size() - newNames->size())
              << " outlier decoys.";
     cout << endl;
     delete mNames;
+    delete mIDs;
     mNames = newNames;
+    mIDs = newIDs;
     mPDBs  = newDecoys;
     mNumPDB = mPDBs->size();
     if (!mNumPDB)
@@ -1060,12 +1640,26 @@ Clustering::cluster()
 #endif
     start = clock();
     initRef(NULL);
+    if (mCheckpoint)
+        mCheckpoint->putReference(mReference, REFERENCE_SIZE*mNumPDB);
     auxClustering(); // Cluster to speed-up computation of neighbors
     elapsed = (clock() - start)/(double)CLOCKS_PER_SEC;
 #ifdef _SHOW_PERCENTAGE_COMPLETE_
     cout << "\nAuxiliaryClustering...";
 #endif
     cout << " completed in " << elapsed << " s" << endl;
+    if (mIndex) // keep what was derived for the next clustering
+    {
+        vector<float *> coords;
+        for (int i=0; _use_scud_ && i < mNumPDB; i++)
+            coords.push_back((*mPDBs)[i]->mCAlpha);
+        mIndex->write(coords, mReference, REFERENCE_SIZE, CLU_RADIUS,
+                      _use_scud_, mCen, mD2C);
+        delete mIndex;
+        mIndex = NULL;
+    }
+    if (mCheckpoint)
+        mCheckpoint->putAux(mNumPDB, mCen, mD2C);
 
     cout << "Finding decoys neighbors...";
     //start = clock();
@@ -1073,6 +1667,8 @@ Clustering::cluster()
     _get_elapsed(1);
 #endif
     buildAdjacentLists(); // Find all the neighbors for each decoy
+    delete mCheckpoint; // once all of it is written
+    mCheckpoint = NULL;
     //elapsed = (clock() - start)/(double)CLOCKS_PER_SEC;
 #ifndef __WIN32__
     elapsed = _get_elapsed(0);
@@ -1080,6 +1676,8 @@ Clustering::cluster()
 #else
     cout << " completed" << endl;
 #endif
+    if (mDistCache)
+        mDistCache->showStats();
 
     //listAdjacentLists();
 
@@ -1113,7 +1711,7 @@ Clustering::cluster()
      * one such "other cluster* should be ensured.
      */
     AdjacentList* bestClus = (*mFinalClusters)[0];
-    bestClusSize = bestClus->mNumNeigh;
+    bestClusSize = bestClus->mSize;
     int nextSize = 0;
     if (mFinalClusters->size() > 1)
     {
@@ -1129,13 +1727,13 @@ Clustering::cluster()
 
 
 void
-Clustering::showClusters(int numClus)
+Clustering::showClusters(int numClus, ostream& out)
 {
 #ifdef _ADD_LITE_MODE_
     if (AdjacentList::mListMode == LITE)
     {
-        cout << "Best decoy: " << (*mNames)[mFinalDecoy] << "\t"
-             << mAdjacentList[mFinalDecoy]->mNumNeigh << endl;
+        out << "Best decoy: " << (*mNames)[mFinalDecoy] << "\t"
+             << mAdjacentList[mFinalDecoy]->mSize << endl;
         return;
     }
 #endif
@@ -1147,8 +1745,8 @@ Clustering::showClusters(int numClus)
     {
         AdjacentList* clu = (*mFinalClusters)[i];
         //cout << clu->mWhich << "'" << (*mNames)[clu->mWhich]
-        cout << (*mNames)[clu->mWhich]
-             << " " << clu->mNumNeigh << ": ";
+        out << (*mNames)[clu->mWhich]
+             << " " << clu->mSize << ": ";
         int size2 = clu->mNumNeigh;
         vector<int>* neigh = clu->neigh;
         for (int j=0; j < size2; j++) // for each neighboring decoy...
@@ -1156,25 +1754,32 @@ Clustering::showClusters(int numClus)
             // output its decoy number and name...
             int decoy = (*neigh)[j];
             //cout << decoy << "'" << (*mNames)[decoy] << "'";
-            cout << (*mNames)[decoy] << "\t";
+            out << (*mNames)[decoy] << "\t";
+            // ...and those of the decoys collapsed into it
+            if (mMultiplicity && mMultiplicity[decoy] > 1)
+            {
+                vector<char *>& collapsed = mCollapsed[(*mIDs)[decoy]];
+                for (int k=0; k < collapsed.size(); k++)
+                    out << collapsed[k] << "\t";
+            }
             // ...and its distance
             //if (AdjacentList::mListMode == LIST)
             //    cout << (*(clu->dist))[j] << ", ";
             //else
             //    cout << clu->getD(decoy) << ", ";
         }
-        cout << endl;
+        out << endl;
     }
 }
 
 
 /**
- * Get the names and Strus of the (first num_elements) indices in list into
- * Names and PDBs respectively.
+ * Get the names, ids and Strus of the (first num_elements) indices in list
+ * into Names, IDs and PDBs respectively.
  */
 void
-Clustering::getPDBs(vector<char *>* Names, vector<Stru *>* PDBs,
-                    vector<int>* list, int num_elements)
+Clustering::getPDBs(vector<char *>* Names, vector<int>* IDs,
+                    vector<Stru *>* PDBs, vector<int>* list, int num_elements)
 {
     int x;
     for (int i=0; i < num_elements; i++)
@@ -1182,6 +1787,7 @@ Clustering::getPDBs(vector<char *>* Names, vector<Stru *>* PDBs,
         x = (*list)[i];
         PDBs->push_back((*mPDBs)[x]);
         Names->push_back((*mNames)[x]);
+        IDs->push_back((*mIDs)[x]);
     }
 }
 
@@ -1230,6 +1836,25 @@ Clustering::listAdjacentLists()
 void
 Clustering::auxClustering()
 {
+    const int * cen;
+    const float * d2c;
+    if ((mIndex && mIndex->aux(CLU_RADIUS, _use_scud_, &cen, &d2c))
+        || (mCheckpoint && mCheckpoint->aux(mNumPDB, &cen, &d2c)))
+    {
+        for (int i=0; i < mNumPDB; i++)
+        {
+            mCen[i] = cen[i];
+            mD2C[i] = d2c[i];
+            if (cen[i] == i) // a cluster center
+            {
+                mAuxCluster[i] = new vector<int>(0);
+                mCluCen->push_back(i);
+            }
+            mAuxCluster[cen[i]]->push_back(i);
+        }
+        return;
+    }
+
     float lower, upper, upper_scud;
     for (int i=0; i < mNumPDB; i++) // for each decoy
     {
@@ -1334,13 +1959,46 @@ Clustering::buildAdjacentLists()
 #ifdef _SHOW_PERCENTAGE_COMPLETE_
     printf("\r");
 #endif
-    for (int c=0; c < numc; c++) // for each cluster center
+
+    // The neighbors found for the centers done before the clustering was
+    // stopped are taken from the checkpoint, in the order they were added
+    int done = 0;
+    const Checkpoint::Entry * entries;
+    size_t numEntries;
+    while (mCheckpoint && done < numc
+           && mCheckpoint->nextCenter(&entries, &numEntries))
+    {
+        for (size_t k=0; k < numEntries; k++)
+        {
+            const Checkpoint::Entry& e = entries[k];
+#ifdef _ADD_LITE_MODE_
+            if (AdjacentList::mListMode == LITE)
+            {
+                mAdjacentList[e.which]->add(e.n);
+                continue;
+            }
+#endif
+            mAdjacentList[e.which]->add(e.n, e.d, true);
+        }
+        done++;
+    }
+    // and those found for the rest are checkpointed, center by center
+    vector<Checkpoint::Entry> added;
+    AdjacentList::mLog = mCheckpoint? &added: NULL;
+
+    for (int c=done; c < numc; c++) // for each cluster center
     {
         float d, _d;
         int cen = (*mCluCen)[c];
 #ifdef _SHOW_PERCENTAGE_COMPLETE_
         printf("Finding decoys' neighbors... completed %4.1f%%\r", 100.*c/numc);
         fflush(stdout);
+#endif
+#ifdef _ADD_LITE_MODE_
+        // the decoys that the elements of the cluster stand for
+        int weight = 0;
+        for (int n=0; n < mAuxCluster[cen]->size(); n++)
+            weight += AdjacentList::weight((*mAuxCluster[cen])[n]);
 #endif
         for (int i=0; i < mNumPDB; i++) // for each decoy
         {
@@ -1361,7 +2019,7 @@ Clustering::buildAdjacentLists()
 #ifdef _ADD_LITE_MODE_
                     if (AdjacentList::mListMode == LITE)
                     {
-                        mAdjacentList[i]->add(size);
+                        mAdjacentList[i]->add(weight);
                         continue;
                     }
 #endif
@@ -1392,7 +2050,7 @@ Clustering::buildAdjacentLists()
 #ifdef _ADD_LITE_MODE_
                 if (AdjacentList::mListMode == LITE)
                 {
-                    mAdjacentList[i]->add(size);
+                    mAdjacentList[i]->add(weight);
                     continue;
                 }
 #endif
@@ -1408,7 +2066,7 @@ Clustering::buildAdjacentLists()
 #ifdef _ADD_LITE_MODE_
                 if (AdjacentList::mListMode == LITE)
                 {
-                    mAdjacentList[i]->add(size);
+                    mAdjacentList[i]->add(weight);
                     continue;
                 }
 #endif
@@ -1449,7 +2107,7 @@ Clustering::buildAdjacentLists()
 #ifdef _ADD_LITE_MODE_
                 if (AdjacentList::mListMode == LITE)
                 {
-                    mAdjacentList[i]->add(size);
+                    mAdjacentList[i]->add(weight);
                     continue;
                 }
 #endif
@@ -1472,7 +2130,7 @@ Clustering::buildAdjacentLists()
 #ifdef _ADD_LITE_MODE_
                     if (AdjacentList::mListMode == LITE)
                     {
-                        mAdjacentList[i]->add(1);
+                        mAdjacentList[i]->add(AdjacentList::weight(e));
                         continue;
                     }
 #endif
@@ -1493,7 +2151,7 @@ Clustering::buildAdjacentLists()
 #ifdef _ADD_LITE_MODE_
                         if (AdjacentList::mListMode == LITE)
                         {
-                             mAdjacentList[i]->add(1);
+                             mAdjacentList[i]->add(AdjacentList::weight(e));
                              continue;
                         }
 #endif
@@ -1506,7 +2164,7 @@ Clustering::buildAdjacentLists()
 #ifdef _ADD_LITE_MODE_
                         if (AdjacentList::mListMode == LITE)
                         {
-                             mAdjacentList[i]->add(1);
+                             mAdjacentList[i]->add(AdjacentList::weight(e));
                              continue;
                         }
 #endif
@@ -1525,7 +2183,7 @@ Clustering::buildAdjacentLists()
 #ifdef _ADD_LITE_MODE_
                         if (AdjacentList::mListMode == LITE)
                         {
-                             mAdjacentList[i]->add(1);
+                             mAdjacentList[i]->add(AdjacentList::weight(e));
                              continue;
                         }
 #endif
@@ -1534,7 +2192,13 @@ Clustering::buildAdjacentLists()
                 }
             }
         }
+        if (mCheckpoint)
+        {
+            mCheckpoint->putCenter(c, added);
+            added.clear();
+        }
     }
+    AdjacentList::mLog = NULL;
 }
 
 //- = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = -
@@ -1578,6 +2242,8 @@ Clustering::trueD(int i, int j)
     float d = mAdjacentList[i]->getD(j);
     if (d < _OVER_RMSD_ && d >= 0)
         return d;
+    if (mDistCache && mDistCache->get(i, j, d))
+        return d;
     float* coor1 = (*mPDBs)[i]->mCAlpha;
     float* coor2 = (*mPDBs)[j]->mCAlpha;
     double rmsd;
@@ -1598,6 +2264,8 @@ Clustering::trueD(int i, int j)
 #else // don't bother with fast_rmsd
     rmsd = RMSD(coord1, coord2, mLen);
 #endif
+    if (mDistCache)
+        mDistCache->put(i, j, (float) rmsd);
     return (float) rmsd;
 }
 
@@ -1610,6 +2278,8 @@ Clustering::eucD(int i, int j)
     float d = mAdjacentList[i]->getD(j);
     if (d < _OVER_RMSD_ && d >= 0)
         return d;
+    if (mDistCache && mDistCache->get(i, j, d)) // RMSD is a tighter bound
+        return d;
     float* coor1 = (*mPDBs)[i]->mCAlpha;
     float* coor2 = (*mPDBs)[j]->mCAlpha;
     float rev=0;
@@ -1701,11 +2371,11 @@ int
 Clustering::findDecoyWithMostNeighbors()
 {
     int largest = mRemainingList[0];
-    int currentSize = mAdjacentList[largest]->mNumNeigh;
+    int currentSize = mAdjacentList[largest]->mSize;
     for (int i=1; i < mRemainingSize; i++)
     {
         int next_index = mRemainingList[i];
-        int next_size = mAdjacentList[next_index]->mNumNeigh;
+        int next_size = mAdjacentList[next_index]->mSize;
         if (next_size > currentSize)
         {
             currentSize = next_size;
@@ -1716,6 +2386,30 @@ Clustering::findDecoyWithMostNeighbors()
 }
 
 
+/**
+ * In DISK mode the AdjacentLists only count the neighbors. Bring the
+ * neighbors of decoy which that are not yet removed into a new AdjacentList.
+ */
+AdjacentList *
+Clustering::loadAdjacentList(int which)
+{
+    AdjacentList* adj = new AdjacentList();
+    adj->mWhich = which;
+    const DiskAdjacency::Entry * list = mDiskAdjacency->list(which);
+    int size = mDiskAdjacency->size(which);
+    for (int i=0; i < size; i++)
+    {
+        if (mRemainingListIndex[list[i].n] < 0) // removed
+            continue;
+        adj->neigh->push_back(list[i].n);
+        adj->dist->push_back(list[i].d);
+        adj->mSize += AdjacentList::weight(list[i].n);
+    }
+    adj->mNumNeigh = adj->neigh->size();
+    return adj;
+}
+
+
 /**
  * Remove all the decoys in adj from all AdjacentList of all decoys.
  */
@@ -1734,8 +2428,27 @@ Clustering::removeDecoys(AdjacentList* adj)
         int index = mRemainingListIndex[to_remove];
         mRemainingList[index] = mRemainingList[mRemainingSize-1];
         mRemainingListIndex[mRemainingList[index]] = index;
+        mRemainingListIndex[to_remove] = -1;
         mRemainingSize--;
 
+        if (AdjacentList::mListMode == DISK)
+        {
+            // The lists on disk are not changed. Instead, removed decoys
+            // are skipped, and only the neighbors' counts are updated
+            const DiskAdjacency::Entry * list = mDiskAdjacency->list(to_remove);
+            int size2 = mDiskAdjacency->size(to_remove);
+            for (int j=0; j<size2; j++)
+            {
+                int n = list[j].n;
+                if (n != this_list && mRemainingListIndex[n] >= 0)
+                {
+                    mAdjacentList[n]->mNumNeigh--;
+                    mAdjacentList[n]->mSize -= AdjacentList::weight(to_remove);
+                }
+            }
+            continue;
+        }
+
         // remove "to_remove" from the AdjacentList of all its neighbors
         AdjacentList* _neighbors_of_to_remove = mAdjacentList[to_remove];
         vector<int>* neighbors_of_to_remove = _neighbors_of_to_remove->neigh;
@@ -1770,7 +2483,7 @@ Clustering::findLargestClusters()
         mRemainingList[i] = i;
         mRemainingListIndex[i] = i;
         // Remember the original size of the cluster
-        mNumNeighbor[i] = mAdjacentList[i]->mNumNeigh;
+        mNumNeighbor[i] = mAdjacentList[i]->mSize;
     }
 
 #ifdef _ADD_LITE_MODE_
@@ -1781,10 +2494,15 @@ Clustering::findLargestClusters()
     }
 #endif
 
+    if (AdjacentList::mListMode == DISK)
+        mDiskAdjacency->finish();
+
     while (mRemainingSize > 1)
     {
         int largest = findDecoyWithMostNeighbors();
         AdjacentList* adj = mAdjacentList[largest];
+        if (AdjacentList::mListMode == DISK)
+            adj = loadAdjacentList(largest);
         mFinalClusters->push_back(adj);
         removeDecoys(adj);
     }
@@ -1812,6 +2530,162 @@ Clustering::findFinalRMSD()
 
 
 
+//- = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = -
+// Codes for fitting the data structures into memory
+//- = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = -
+
+static double
+_physical_memory()
+{
+#ifndef __WIN32__
+    return (double) sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGE_SIZE);
+#else
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    GlobalMemoryStatusEx(&status);
+    return (double) status.ullTotalPhys;
+#endif
+}
+
+/**
+ * The number of bytes we allow ourselves to use. Unless set by the user,
+ * this is DEFAULT_MEM_LIMIT_FRACTION of the physical memory.
+ */
+double
+Clustering::getMemLimit()
+{
+    if (MEM_LIMIT <= 0)
+        MEM_LIMIT = DEFAULT_MEM_LIMIT_FRACTION * _physical_memory();
+    return MEM_LIMIT;
+}
+
+/**
+ * Bytes needed to keep numDecoys decoys of len residues, together with
+ * their signatures, in memory
+ */
+double
+Clustering::decoysFootprint(double numDecoys, int len)
+{
+    double perDecoy = sizeof(SimPDB) + sizeof(Stru)
+                      + 3*len*sizeof(float)  // coordinates
+                      + len*sizeof(float);   // signature
+    return numDecoys * perDecoy;
+}
+
+/**
+ * Bytes needed by the AdjacentLists (and the auxiliary clustering) of mNumPDB
+ * decoys in the given mode, when a fraction density of all pairs of decoys
+ * are neighbors.
+ */
+double
+Clustering::adjacencyFootprint(ADJ_LIST_MODE mode, float density)
+{
+    double N = mNumPDB;
+    double perDecoy = sizeof(AdjacentList) + 2*sizeof(vector<int>)
+                      + sizeof(float) + 2*sizeof(int)     // mD2C, mCen...
+                      + REFERENCE_SIZE*sizeof(float);     // mReference
+    if (mode == MATRIX)
+        perDecoy += N * (sizeof(int) + sizeof(float) + sizeof(LIST_TYPE));
+    else if (mode == LIST) // vectors grow by doubling; allow half unused
+        perDecoy += 1.5 * density * N * (sizeof(int) + sizeof(float));
+    return N * perDecoy;
+}
+
+/**
+ * Estimate the fraction of decoy pairs within THRESHOLD from numPairs
+ * randomly chosen pairs
+ */
+float
+Clustering::sampleNeighborDensity(int numPairs)
+{
+    if (mNumPDB < 2)
+        return 1;
+    // a generator of its own, so that rand() is not reseeded midway
+    minstd_rand pick(time(NULL)/2);
+    int numNeighbors = 0;
+    for (int k=0; k < numPairs; k++)
+    {
+        int i = pick() % mNumPDB;
+        int j = pick() % mNumPDB;
+        if (i == j || trueD((*mPDBs)[i], (*mPDBs)[j]) <= THRESHOLD)
+            numNeighbors++;
+    }
+    return numNeighbors / (float) numPairs;
+}
+
+/**
+ * Use MATRIX mode, which is faster, if it fits into the memory limit.
+ * Otherwise, use LIST mode if it fits, or else DISK mode.
+ */
+void
+Clustering::chooseListMode()
+{
+    double limit = getMemLimit();
+    double decoys = decoysFootprint(mNumPDB, mLen);
+    double matrix = adjacencyFootprint(MATRIX, 1);
+
+    // Whatever was chosen before was for a different set of decoys
+    delete mDistCache;
+    mDistCache = NULL;
+    delete mDiskAdjacency;
+    mDiskAdjacency = NULL;
+    AdjacentList::mDisk = NULL;
+
+    cout << "Memory limit " << _MB(limit) << " MB. Decoys need "
+         << _MB(decoys) << " MB, MATRIX mode needs " << _MB(matrix) << " MB"
+         << endl;
+    if (decoys + matrix <= limit)
+    {
+        cout << "Using MATRIX mode" << endl;
+        AdjacentList::mListMode = MATRIX;
+        return;
+    }
+
+    float density = sampleNeighborDensity(NUM_PAIRS_FOR_DENSITY);
+    double list = adjacencyFootprint(LIST, density);
+    cout << "Sampled neighbor density " << (density*100) << "%. "
+         << "LIST mode needs about " << _MB(list) << " MB" << endl;
+
+    double cacheBytes = limit - decoys - list;
+    if (cacheBytes >= 0)
+    {
+        cout << "Using LIST mode" << endl;
+        AdjacentList::mListMode = LIST;
+    }
+    else
+    {
+        // Neither fits. Keep the neighbor lists on disk, and split what
+        // memory remains between buffering them and caching distances
+        double spare = limit - decoys - adjacencyFootprint(DISK, 0);
+        if (spare < 2*MIN_DISK_BUFFER_BYTES)
+        {
+            cout << "WARNING: the decoys alone nearly exceed the memory limit"
+                 << endl;
+            // but a limit even below that is kept to
+            spare = limit < 2*MIN_DISK_BUFFER_BYTES? limit:
+                                                     2*MIN_DISK_BUFFER_BYTES;
+        }
+        cout << "Using DISK mode (buffering " << _MB(spare/2) << " MB)"
+             << endl;
+        AdjacentList::mListMode = DISK;
+        mDiskAdjacency = new DiskAdjacency(mNumPDB, spare/2);
+        AdjacentList::mDisk = mDiskAdjacency;
+        cacheBytes = spare/2;
+    }
+
+    // Neither LIST nor DISK mode remember computed distances. Cache some of
+    // them with whatever memory is left
+    double maxCacheBytes = (double) DIST_CACHE_ENTRIES_PER_DECOY * mNumPDB
+                           * DistCache::bytesPerEntry();
+    if (cacheBytes > maxCacheBytes)
+        cacheBytes = maxCacheBytes;
+    delete mDistCache;
+    mDistCache = new DistCache(cacheBytes);
+    cout << "Caching up to " << (long) mDistCache->capacity()
+         << " distances" << endl;
+}
+
+
 //- = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = -
 // Random decoys finding codes
 //- = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = -
@@ -1819,11 +2693,11 @@ Clustering::findFinalRMSD()
 /**
  * Randomly permute the numbers, and select the first size decoys
  */
-vector<char *>*
-Clustering::getRandomDecoyNames(vector<char *>* srcnames, int size, int seed)
+vector<int>*
+Clustering::getRandomDecoyIDs(vector<int>* srcids, int size, int seed)
 {
     srand(time(NULL)/2+seed);
-    int totalsize = srcnames->size();
+    int totalsize = srcids->size();
     int* randomArray = new int[totalsize];
     for (int i = 0; i < totalsize; i++) // create an array of 0,...,totalsize-1
         randomArray[i] = i;
@@ -1838,13 +2712,13 @@ Clustering::getRandomDecoyNames(vector<char *>* srcnames, int size, int seed)
         randomArray[i] = t;
     }
     // copy the first randomDecoysSize elements into a smaller array
-    vector<char *> * names = new vector<char *>(0);
+    vector<int> * ids = new vector<int>(0);
     for (int i = 0; i < size; i++)
     {
-        names->push_back((*srcnames)[randomArray[i]]);
+        ids->push_back((*srcids)[randomArray[i]]);
     }
     delete [] randomArray;
-    return names;
+    return ids;
 }
 
 
@@ -1852,9 +2726,9 @@ Clustering::getRandomDecoyNames(vector<char *>* srcnames, int size, int seed)
  * Destroy the random decoys
  */
 void
-Clustering::destroyRandomDecoys(vector<char *>* names, vector<Stru *>* decoys)
+Clustering::destroyRandomDecoys(vector<int>* ids, vector<Stru *>* decoys)
 {
-    delete names; // these names are shared
+    delete ids;
 
     // decoys should be read using readDecoys(), and should be safe to delete
     int size = decoys->size();
@@ -1879,12 +2753,11 @@ Clustering::destroyRandomDecoys(vector<char *>* names, vector<Stru *>* decoys)
  */
 float **
 Clustering::getNborList(vector<Stru *> * decoys,
-                        vector<char *> * nborsCandidates,
+                        vector<int> * nborsCandidates,
                         int listLength)
 {
     // For each decoy i find its neighbors: nbors[0],nbors[1],...,nbors[N-1]
     float ** nbors, * nl, r;
-    char * dName;
     Stru *a, *b;
     int N = decoys->size();   // decoys to build neighbor list of
     int M = nborsCandidates->size(); // #candidates to test to fill list
@@ -1898,10 +2771,10 @@ Clustering::getNborList(vector<Stru *> * decoys,
         for (int j=0; j < listLength; j++)
             nbors[i][j] = 1000.0;
     }
+    Prefetcher prefetcher(*nborsCandidates, mLen);
     for (int i=0; i < M; i++) // for each candidate...
     {
-        dName = (*nborsCandidates)[i];
-        a = new Stru(new SimPDB(dName, mLen), mLen);
+        a = new Stru(prefetcher.next(), mLen);
         for (int j=0; j < N; j++) // ...insert it into each candidate list.
         {
             nl = nbors[j];
@@ -1929,7 +2802,7 @@ Clustering::getNborList(vector<Stru *> * decoys,
 }
 
 /**
- * Same as getNeighborList(vector<Stru *> *, vector<char *> *, int)
+ * Same as getNeighborList(vector<Stru *> *, vector<int> *, int)
  * but with the second parameter already read as Stru.
 float **
 Clustering::getNborList(vector<Stru *> * decoys,
@@ -2202,7 +3075,7 @@ Clustering::estimateDist(vector<Stru *> * decoys, float xPercent,
     if (autoAdjustPercentile) // Use smaller thresholds for larger data sets
     {
         //xPercentile = 1000./sqrt(mNames->size());
-        xPercentile = 100./sqrt(sqrt(mNames->size()));
+        mPercentile = 100./sqrt(sqrt(mNames->size()));
         if (xPercent > MAX_PERCENTILE_FOR_THRESHOLD)
             xPercent = MAX_PERCENTILE_FOR_THRESHOLD;
         if (xPercent < MIN_PERCENTILE_FOR_THRESHOLD)
@@ -2334,12 +3207,15 @@ Clustering::initRef(int* index)
 
     int numPDB = mNames->size();
     mReference = new float[REFERENCE_SIZE*mNumPDB];
+    const float * indexed = mIndex? mIndex->reference(REFERENCE_SIZE): NULL;
+    if (indexed == NULL && mCheckpoint)
+        indexed = mCheckpoint->reference(REFERENCE_SIZE*mNumPDB);
 
     for (int j=0; j < mNumPDB; j++)
     {
         for (int i=0; i < REFERENCE_SIZE; i++)
         {
-            float d = trueD(index[i],j);
+            float d = indexed? indexed[j*REFERENCE_SIZE+i]: trueD(index[i],j);
             mAdjacentList[index[i]]->add(j, d, false);
             mAdjacentList[j]->add(index[i], d, false);
             mReference[j*REFERENCE_SIZE+i] = d; //trueD(index[i],j);
@@ -25,8 +25,14 @@
 #define _INIT_CLUSTER_
 
 #include "SimpPDB.h"
+#include "DistCache.h"
+#include "DiskAdjacency.h"
+#include "PackIndex.h"
+#include "ResultCache.h"
+#include "Checkpoint.h"
 //#include "sys/resource.h"
 #include <vector>
+#include <map>
 #include <stdlib.h>
 #include <string.h>
 
@@ -38,21 +44,30 @@ typedef unsigned short LIST_TYPE;
 typedef unsigned int LIST_TYPE;
 #endif
 
-// _MATRIX_MODE_LIMIT_ is determined by the RAM of the system
-#define _MATRIX_MODE_LIMIT_ 13000
+// Fraction of the physical memory used when no memory limit is given
+#define DEFAULT_MEM_LIMIT_FRACTION 0.75
+// Number of decoy pairs sampled to estimate the density of neighbors
+#define NUM_PAIRS_FOR_DENSITY 2000
+// Most distances per decoy that the DistCache holds in LIST mode
+#define DIST_CACHE_ENTRIES_PER_DECOY 64
+// Least memory for buffering neighbor lists in DISK mode, unless the
+// memory limit is below it
+#define MIN_DISK_BUFFER_BYTES (16*1024*1024)
 
 #define _OVER_RMSD_ 9999999
 
 #define REFERENCE_SIZE 6
 #define RANDOM_DECOY_SIZE_FOR_FILTERING 101
 #define RANDOM_DECOY_SIZE_FOR_THRESHOLD 101
+// Decoys of a stream to estimate the threshold range from, before the rest
+#define STREAM_SAMPLE_DECOYS 1000
 #define NUM_TRIALS_FOR_THRESHOLD 16
 #define DEFAULT_PERCENTILE_FOR_THRESHOLD 10
 #define MAX_PERCENTILE_FOR_THRESHOLD 50
 #define MIN_PERCENTILE_FOR_THRESHOLD 3
 
 
-enum ADJ_LIST_MODE { MATRIX, LIST , LITE };
+enum ADJ_LIST_MODE { MATRIX, LIST , LITE, DISK };
 
 enum EST_THRESHOLD_MODE {
     PERCENT_EDGES,      // % quantile pairwise distance (default)
@@ -69,8 +84,14 @@ class AdjacentList
 {
 public:
     static ADJ_LIST_MODE mListMode;
+    static DiskAdjacency* mDisk; // where the neighbors go in DISK mode
+    static int* mMultiplicity; // of each decoy, or NULL if all are 1
+    static int weight(int n) { return mMultiplicity? mMultiplicity[n]: 1; }
+    static vector<Checkpoint::Entry>* mLog; // neighbors added, if logged
     int mWhich;         // index of the decoy this AdjacentList is for
     int mNumNeigh;      // synchronized with the size of neigh
+    int mSize;          // the decoys that the neighbors stand for, which
+                        // is mNumNeigh unless decoys were collapsed
     vector<int>* neigh; // keep a record of all the neighbors
     vector<float>* dist;
     LIST_TYPE* mReverseIndex; // References index of the decoy within the array
@@ -108,14 +129,24 @@ public:
     static float xPercentile;
     static bool autoAdjustPercentile;
     static float xFactor;
+    static double MEM_LIMIT; // in bytes. 0 to use a fraction of the RAM
+    static bool COLLAPSE;    // collapse decoys with the same coordinates
+    static float COLLAPSE_RMSD; // or within this RMSD, if above 0
 
     char* mInputFileName;   // file which contains all PDB filenames
-    vector<char* >* mNames; // all decoy (file) names
+    vector<char* >* mNames; // all decoy (file) names, for output only
+    vector<int>* mIDs;      // all decoy ids (see SimPDB::decoyNames)
     vector<Stru* >* mPDBs;  // all decoy PDBs
     int mNumPDB;            // will be set to mPDBs->size()
     int mLen;               // #residues
+    map<int, vector<char *> > mCollapsed; // by decoy id, the names of the
+                            // decoys collapsed into it (see COLLAPSE)
+    int * mMultiplicity;    // of each decoy, or NULL if none has others
+    NamedSelection * mSelection; // of SimPDB::selections to cluster, if any
 
     float THRESHOLD;        // clustering threshold. most important parameter
+    float mPercentile;      // xPercentile, as adjusted to the decoys when
+                            // autoAdjustPercentile (see estimateDist)
 
     // - = - = - = - = - = - = - = - = - = - = - = - = - = -
     // for auxiliary grouping
@@ -125,7 +156,7 @@ public:
     vector<int>** mAuxCluster; // cluster elements
     int* mCen;
     float* mD2C;          // distance from decoy in auxCluster to CluCen
-    int * mNumNeighbor;   // the number of neighbors of each decoy
+    int * mNumNeighbor;   // the number of neighbors of each decoy (mSize)
     float bestClusMargin; // size(bestClus) -origsuze(2ndClus) /size(bestClus)
     int bestClusSize;
 
@@ -134,6 +165,11 @@ public:
 
     AdjacentList** mAdjacentList; // lists of all neighbors
     float* mReference;      // for {lower,upper}bounds through references
+    DistCache* mDistCache;  // computed distances, when not in MATRIX mode
+    DiskAdjacency* mDiskAdjacency; // neighbor lists, in DISK mode
+    PackIndex* mIndex;      // of the pack file clustered, until clustered
+    ResultCache* mCache;    // of the results, if they are cached (--cache)
+    Checkpoint* mCheckpoint; // of the clustering, until neighbors are found
 
     int mFinalDecoy;
     vector<AdjacentList *> *mFinalClusters;
@@ -146,36 +182,52 @@ public:
     //- = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = -
 
     Clustering(); // do nothing
-    void initialize(char * filename, float threshold);
-    void reinitialize(vector<char *>*, vector<Stru *>*, float threshold);
+    ~Clustering(); // of a clustered object
+    bool initialize(char * filename, float threshold);
+    void reinitialize(vector<char *>*, vector<int>*, vector<Stru *>*,
+                      float threshold);
     void cluster();
-    void showClusters(int);
-    void getPDBs(vector<char *>*, vector<Stru *>*, vector<int>*, int);
+    void showClusters(int, ostream& = cout);
+    void getPDBs(vector<char *>*, vector<int>*, vector<Stru *>*,
+                 vector<int>*, int);
 
 
     //- = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = -
 
     // for reading decoys from input files
     void readDecoyNames();
-    void readDecoys(vector<char *>*, vector<Stru *>*);
-    vector<Stru *>* readDecoys(vector<char *>*);
+    void collapseDecoys();
+    void setMultiplicity();
+    void readDecoys(vector<int>*, vector<Stru *>*);
+    vector<Stru *>* readDecoys(vector<int>*);
     //void refilterDecoys(vector<char *>*, vector<Stru *>*);
 
     // - = - = - = - = - = - = - = - = - = - = - = -
     // for finding threshold
 
-    void getThresholdAndDecoys();
+    bool getThresholdAndDecoys();
+    string thresholdOptions();
+    string clusterOptions();
     float getThreshold(float **, int, int, int, int, float, float);
-    float ** getNborList(vector<Stru *> *, vector<char *> *, int);
+    float ** getNborList(vector<Stru *> *, vector<int> *, int);
     //float ** getNborList(vector<Stru *> *, vector<Stru *> *, int);
     float ** getNborList(vector<Stru *> *, int, float *, float *);
-    void estimateDist(vector<char *>*, int, int, float,
+    void estimateDist(vector<int>*, int, int, float,
                       float *, float *, float *, float *);
     void estimateDist(vector<Stru *>*, float,
                       float *, float *, float *, float *);
 
-    vector<char *>* getRandomDecoyNames(vector<char *>*, int, int);
-    void destroyRandomDecoys(vector<char *>*, vector<Stru *>*); 
+    vector<int>* getRandomDecoyIDs(vector<int>*, int, int);
+    void destroyRandomDecoys(vector<int>*, vector<Stru *>*);
+
+    // - = - = - = - = - = - = - = - = - = - = - = -
+    // for choosing the representations that fit into memory
+
+    static double getMemLimit();
+    double decoysFootprint(double numDecoys, int len);
+    double adjacencyFootprint(ADJ_LIST_MODE mode, float density);
+    float sampleNeighborDensity(int numPairs);
+    void chooseListMode();
 
  
     // - = - = - = - = - = - = - = - = - = - = - = -
@@ -188,6 +240,7 @@ public:
     void findLargestClusters();
     int findDecoyWithMostNeighbors();
     void removeDecoys(AdjacentList * adj);
+    AdjacentList * loadAdjacentList(int which);
 
     // - = - = - = - = - = - = - = - = - = - = - = -
 
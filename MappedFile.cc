@@ -0,0 +1,137 @@
+/*
+ *  **************************************************************************
+ *  Copyright 2026 Shuai Cheng Li and Yen Kaow Ng
+ *  **************************************************************************
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  **************************************************************************
+ * 
+ */
+
+
+#ifndef __WIN32__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+#include "MappedFile.h"
+
+
+#ifndef __WIN32__
+
+MappedFile::MappedFile(const char * filename, bool writable, bool shared)
+{
+    mData = "";
+    mSize = 0;
+    mOpen = false;
+    mMapped = false;
+
+    int fd = open(filename, writable && shared? O_RDWR: O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) == 0)
+    {
+        mOpen = true;
+        if (st.st_size > 0)
+        {
+            int prot = writable? PROT_READ | PROT_WRITE: PROT_READ;
+            void * p = mmap(NULL, st.st_size, prot,
+                            shared? MAP_SHARED: MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED)
+                mOpen = false;
+            else
+            {
+                mData = (const char *) p;
+                mSize = st.st_size;
+                mMapped = true;
+            }
+        }
+    }
+    close(fd); // the mapping stays valid
+}
+
+MappedFile::~MappedFile()
+{
+    if (mMapped)
+        munmap((void *) mData, mSize);
+}
+
+#else
+
+MappedFile::MappedFile(const char * filename, bool writable, bool shared)
+{
+    mData = "";
+    mSize = 0;
+    mOpen = false;
+    mMapped = false;
+    mMapping = NULL;
+
+    bool writeThrough = writable && shared;
+    mFile = CreateFileA(filename, writeThrough? GENERIC_READ | GENERIC_WRITE:
+                                                GENERIC_READ,
+                        writeThrough? FILE_SHARE_READ | FILE_SHARE_DELETE:
+                                      FILE_SHARE_READ,
+                        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (mFile == INVALID_HANDLE_VALUE)
+        return;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(mFile, &size))
+        return;
+    mOpen = true;
+    if (size.QuadPart == 0)
+        return;
+    mMapping = CreateFileMappingA(mFile, NULL,
+                                  writeThrough? PAGE_READWRITE:
+                                  writable? PAGE_WRITECOPY: PAGE_READONLY,
+                                  0, 0, NULL);
+    if (mMapping != NULL)
+        mData = (const char *) MapViewOfFile(mMapping,
+                                  writeThrough? FILE_MAP_WRITE:
+                                  writable? FILE_MAP_COPY: FILE_MAP_READ,
+                                  0, 0, 0);
+    if (mMapping == NULL || mData == NULL)
+    {
+        mData = "";
+        mOpen = false;
+        return;
+    }
+    mSize = (size_t) size.QuadPart;
+    mMapped = true;
+}
+
+MappedFile::~MappedFile()
+{
+    if (mMapped)
+        UnmapViewOfFile(mData);
+    if (mMapping != NULL)
+        CloseHandle(mMapping);
+    if (mFile != INVALID_HANDLE_VALUE)
+        CloseHandle(mFile);
+}
+
+#endif
+
+bool
+MappedFile::isOpen()
+{
+    return mOpen;
+}
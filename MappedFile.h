@@ -0,0 +1,62 @@
+/*
+ *  **************************************************************************
+ *  Copyright 2026 Shuai Cheng Li and Yen Kaow Ng
+ *  **************************************************************************
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  **************************************************************************
+ * 
+ */
+
+
+#ifndef _MAPPED_FILE_
+#define _MAPPED_FILE_
+
+#include <stddef.h>
+
+
+/**
+ * Read-only view of a whole file, memory-mapped where possible.
+ *
+ * mData is valid (though possibly empty) whenever isOpen() is true, and
+ * stays valid until the MappedFile is destroyed.
+ *
+ * A writable mapping is copy-on-write: changes made through it are private
+ * to this process and never reach the file. A shared writable mapping, as
+ * of a scratch file, writes them through to the file instead, so that they
+ * can be paged out. The name of a file mapped shared can be removed while
+ * it stays mapped.
+ */
+class MappedFile
+{
+public:
+    const char * mData;
+    size_t mSize;
+
+    MappedFile(const char * filename, bool writable = false,
+               bool shared = false);
+    ~MappedFile();
+    bool isOpen();
+
+private:
+    bool mOpen;
+    bool mMapped; // false if mData is empty, or was allocated
+#ifdef __WIN32__
+    void * mFile;
+    void * mMapping;
+#endif
+};
+
+#endif
@@ -0,0 +1,273 @@
+/*
+ *  **************************************************************************
+ *  Copyright 2026 Shuai Cheng Li and Yen Kaow Ng
+ *  **************************************************************************
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  **************************************************************************
+ * 
+ */
+
+
+
+
+
+#include <iostream>
+#include <string>
+
+#include <string.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "PackIndex.h"
+
+using namespace std;
+
+
+PackIndex::PackIndex(const char * packfilename, const vector<int>& ids,
+                     int numResidues)
+    : mIDs(ids)
+{
+    mNumResidues = numResidues;
+    mFileName = new char[strlen(packfilename) + 5];
+    sprintf(mFileName, "%s.idx", packfilename);
+    mFile = NULL;
+    mHeader = NULL;
+    mComplete = true;
+
+    struct stat st;
+    mPackSize = 0;
+    mPackTime = 0;
+    if (stat(packfilename, &st) == 0)
+    {
+        mPackSize = st.st_size;
+        mPackTime = st.st_mtime;
+    }
+
+    MappedFile * file = new MappedFile(mFileName);
+    if (!file->isOpen()) // not indexed yet
+    {
+        delete file;
+        return;
+    }
+    const PackIndexHeader * header = (const PackIndexHeader *) file->mData;
+    unsigned long long n = ids.size();
+    if (file->mSize < sizeof(PackIndexHeader)
+        || memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic))
+        || header->version != INDEX_VERSION
+        || header->byteOrder != INDEX_BYTE_ORDER
+        || header->fileSize != file->mSize
+        || header->fileSize != sizeof(PackIndexHeader)
+               + (unsigned long long) header->numDecoys * (sizeof(int)
+                   + (header->realigned? 3*header->numResidues: 0)
+                     * sizeof(float)
+                   + header->numReferences * sizeof(float)
+                   + (header->auxRadius > 0? sizeof(int) + sizeof(float): 0)))
+        cout << "Index \"" << mFileName << "\" is of another version, or "
+             << "corrupted. Rebuilding it" << endl;
+    else if (header->packSize != mPackSize || header->packTime != mPackTime
+             || header->numDecoys != n || header->numResidues != numResidues
+             || memcmp(file->mData + sizeof(PackIndexHeader), &ids[0],
+                       n*sizeof(int)))
+        cout << "Index \"" << mFileName << "\" is of other decoys. "
+             << "Rebuilding it" << endl;
+    else
+    {
+        mFile = file;
+        mHeader = header;
+        cout << "Using index \"" << mFileName << "\"" << endl;
+        return;
+    }
+    delete file;
+}
+
+
+PackIndex::~PackIndex()
+{
+    delete mFile;
+    delete [] mFileName;
+}
+
+
+/**
+ * Where part (see PackIndexHeader) of the index is, as numbered there, with
+ * 0 for the ids
+ */
+const char *
+PackIndex::section(int part)
+{
+    size_t n = mHeader->numDecoys;
+    size_t offset = sizeof(PackIndexHeader);
+    if (part > 0)
+        offset += n*sizeof(int);
+    if (part > 1 && mHeader->realigned)
+        offset += n*3*mHeader->numResidues*sizeof(float);
+    if (part > 2)
+        offset += n*mHeader->numReferences*sizeof(float);
+    return mFile->mData + offset;
+}
+
+/**
+ * The realigned coordinates of the decoys, one after another, or NULL if
+ * the index has none
+ */
+const float *
+PackIndex::coords()
+{
+    if (mHeader == NULL || !mHeader->realigned)
+    {
+        mComplete = false;
+        return NULL;
+    }
+    return (const float *) section(1);
+}
+
+/**
+ * The distances of each decoy to the numReferences references, or NULL if
+ * the index has none
+ */
+const float *
+PackIndex::reference(int numReferences)
+{
+    if (mHeader == NULL || mHeader->numReferences != numReferences)
+    {
+        mComplete = false;
+        return NULL;
+    }
+    return (const float *) section(2);
+}
+
+/**
+ * Set cen and d2c to the center of each decoy and its distance to it in the
+ * auxiliary partition at radius, with or without SCUD's bound. Returns false
+ * if the index has no such partition.
+ */
+bool
+PackIndex::aux(float radius, bool scud, const int ** cen, const float ** d2c)
+{
+    if (mHeader == NULL || mHeader->auxRadius != radius
+        || mHeader->auxScud != scud)
+    {
+        mComplete = false;
+        return false;
+    }
+    size_t n = mHeader->numDecoys;
+    *cen = (const int *) section(3);
+    *d2c = (const float *) (section(3) + n*sizeof(int));
+
+    // A center comes before the decoys around it, and is its own center
+    for (size_t i=0; i < n; i++)
+    {
+        int c = (*cen)[i];
+        if (c < 0 || (size_t) c > i || (*cen)[c] != c)
+        {
+            cout << "Index \"" << mFileName << "\" is corrupted" << endl;
+            mComplete = false;
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static bool
+_write(FILE * file, const void * data, size_t size)
+{
+    return size == 0 || fwrite(data, size, 1, file) == 1;
+}
+
+/**
+ * Replace the index with the given parts, or where a part is not given
+ * (coords empty, or reference or cen NULL), with that of the index. Does
+ * nothing if all that was asked of the index was there.
+ */
+void
+PackIndex::write(const vector<float *>& coords, const float * reference,
+                 int numReferences, float radius, bool scud, const int * cen,
+                 const float * d2c)
+{
+    if (mHeader && mComplete)
+        return;
+
+    size_t n = mIDs.size();
+    const float * oldCoords = coords.empty() && mHeader? this->coords(): NULL;
+    if (reference == NULL && mHeader && mHeader->numReferences)
+    {
+        numReferences = mHeader->numReferences;
+        reference = (const float *) section(2);
+    }
+    if (cen == NULL && mHeader && mHeader->auxRadius > 0)
+    {
+        radius = mHeader->auxRadius;
+        scud = mHeader->auxScud;
+        aux(radius, scud, &cen, &d2c);
+    }
+
+    PackIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.version = INDEX_VERSION;
+    header.byteOrder = INDEX_BYTE_ORDER;
+    header.packSize = mPackSize;
+    header.packTime = mPackTime;
+    header.numDecoys = n;
+    header.numResidues = mNumResidues;
+    header.realigned = !coords.empty() || oldCoords;
+    header.numReferences = reference? numReferences: 0;
+    header.auxRadius = cen? radius: 0;
+    header.auxScud = cen? scud: 0;
+    header.fileSize = sizeof(header) + n * (sizeof(int)
+                          + (header.realigned? 3*mNumResidues: 0)
+                            * sizeof(float)
+                          + header.numReferences * sizeof(float)
+                          + (cen? sizeof(int) + sizeof(float): 0));
+
+    // Written beside the index, which then gives way to it
+    string temp = string(mFileName) + ".new";
+    FILE * file = fopen(temp.c_str(), "wb");
+    bool written = file != NULL
+        && _write(file, &header, sizeof(header))
+        && _write(file, &mIDs[0], n*sizeof(int));
+    size_t coordsSize = 3*mNumResidues*sizeof(float);
+    for (size_t i=0; written && i < n && header.realigned; i++)
+        written = _write(file, oldCoords? oldCoords + 3*mNumResidues*i:
+                                          coords[i], coordsSize);
+    written = written && (reference == NULL
+                          || _write(file, reference,
+                                    n*numReferences*sizeof(float)));
+    written = written && (cen == NULL
+                          || (_write(file, cen, n*sizeof(int))
+                              && _write(file, d2c, n*sizeof(float))));
+    if (file && fclose(file))
+        written = false;
+
+    delete mFile;
+    mFile = NULL;
+    mHeader = NULL;
+    if (!written)
+    {
+        cout << "WARNING: cannot write index \"" << mFileName << "\"" << endl;
+        remove(temp.c_str());
+        return;
+    }
+    remove(mFileName);
+    if (rename(temp.c_str(), mFileName))
+    {
+        cout << "WARNING: cannot write index \"" << mFileName << "\"" << endl;
+        remove(temp.c_str());
+        return;
+    }
+    cout << "Wrote index \"" << mFileName << "\"" << endl;
+}
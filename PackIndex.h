@@ -0,0 +1,108 @@
+/*
+ *  **************************************************************************
+ *  Copyright 2026 Shuai Cheng Li and Yen Kaow Ng
+ *  **************************************************************************
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  **************************************************************************
+ * 
+ */
+
+
+
+
+#ifndef _PACK_INDEX_
+#define _PACK_INDEX_
+
+#include <vector>
+
+#include "MappedFile.h"
+
+using namespace std;
+
+
+#define INDEX_MAGIC "CALIDX\x1a\x00"
+#define INDEX_VERSION 1
+#define INDEX_BYTE_ORDER 0x01020304
+
+/**
+ * Header of the index file kept next to a pack file (see PackIndex). It is
+ * followed by the ids of the decoys, and then by what of these the index
+ * holds, each as a multiple of numDecoys numbers:
+ * 1. the realigned coordinates, numResidues*3 floats per decoy, if
+ *    realigned (see Clustering::realignDecoys),
+ * 2. the distances to the references, numReferences floats per decoy (see
+ *    Clustering::initRef), and
+ * 3. the auxiliary partition at radius auxRadius if that is above 0, as the
+ *    center of each decoy (ints) and then its distance to it (floats) (see
+ *    Clustering::auxClustering).
+ */
+struct PackIndexHeader
+{
+    char magic[8];              // INDEX_MAGIC
+    unsigned int version;       // INDEX_VERSION
+    unsigned int byteOrder;     // INDEX_BYTE_ORDER
+    unsigned long long packSize; // of the pack file indexed...
+    long long packTime;         // ...and its modification time
+    unsigned int numDecoys;
+    unsigned int numResidues;
+    unsigned int realigned;
+    unsigned int numReferences; // 0 if there are no distances to references
+    float auxRadius;            // 0 if there is no partition
+    unsigned int auxScud;       // whether the partition used SCUD's bound
+    unsigned long long fileSize;
+};
+
+
+/**
+ * What clustering derives from the decoys of a pack file before finding
+ * their neighbors, kept in an index file (the pack file's name followed by
+ * ".idx") for later clusterings of the same decoys to take instead.
+ *
+ * The index is for the decoys with the given ids, as they are after
+ * filtering, and is only used if they are what it was written for, and the
+ * pack file is the same size and as old as when it was written. Each part
+ * is taken only if it is there, and for the same parameters. write() then
+ * replaces the index with what was computed and what was taken.
+ */
+class PackIndex
+{
+private:
+    char * mFileName;
+    vector<int> mIDs;
+    int mNumResidues;
+    unsigned long long mPackSize;
+    long long mPackTime;
+    MappedFile * mFile;                // the index, if valid
+    const PackIndexHeader * mHeader;   // of mFile
+    bool mComplete;                    // whether all asked for was there
+
+    const char * section(int part);
+
+public:
+    PackIndex(const char * packfilename, const vector<int>& ids,
+              int numResidues);
+    ~PackIndex();
+
+    const float * coords();
+    const float * reference(int numReferences);
+    bool aux(float radius, bool scud, const int ** cen, const float ** d2c);
+
+    void write(const vector<float *>& coords, const float * reference,
+               int numReferences, float radius, bool scud, const int * cen,
+               const float * d2c);
+};
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ *  **************************************************************************
+ *  Copyright 2026 Shuai Cheng Li and Yen Kaow Ng
+ *  **************************************************************************
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  **************************************************************************
+ * 
+ */
+
+
+
+
+#include "Prefetcher.h"
+#include "PreloadedPDB.h"
+
+
+Prefetcher::Prefetcher(const vector<int>& ids, int len)
+    : mIDs(ids)
+{
+    mLen = len;
+    mNext = mClaimed = 0;
+    mStop = false;
+    if (SimPDB::preloadPDB || mIDs.size() < 2)
+        return;
+
+    SimPDB::selection(); // compiled here, before the threads share it
+    mSlots.assign(mIDs.size() < PREFETCH_DEPTH? mIDs.size(): PREFETCH_DEPTH,
+                  NULL);
+    int numThreads = PreloadedPDB::numThreads();
+    if (numThreads > mSlots.size())
+        numThreads = mSlots.size();
+    for (int i=0; i < numThreads; i++)
+        mThreads.push_back(thread(&Prefetcher::work, this));
+}
+
+
+Prefetcher::~Prefetcher()
+{
+    {
+        lock_guard<mutex> lock(mLock);
+        mStop = true;
+    }
+    mTaken.notify_all();
+    for (size_t i=0; i < mThreads.size(); i++)
+        mThreads[i].join();
+    for (size_t i=0; i < mSlots.size(); i++)
+        delete mSlots[i];
+}
+
+
+SimPDB *
+Prefetcher::next()
+{
+    if (mThreads.empty())
+        return new SimPDB(mIDs[mNext++], mLen);
+
+    unique_lock<mutex> lock(mLock);
+    SimPDB *& slot = mSlots[mNext % mSlots.size()];
+    while (slot == NULL)
+        mRead.wait(lock);
+    SimPDB * pdb = slot;
+    slot = NULL;
+    mNext++;
+    lock.unlock();
+    mTaken.notify_all();
+    return pdb;
+}
+
+
+/**
+ * Read the decoys, in order, as long as they fit into the slots
+ */
+void
+Prefetcher::work()
+{
+    unique_lock<mutex> lock(mLock);
+    for (;;)
+    {
+        while (!mStop && mClaimed < mIDs.size()
+               && mClaimed >= mNext + mSlots.size())
+            mTaken.wait(lock);
+        if (mStop || mClaimed == mIDs.size())
+            return;
+        size_t i = mClaimed++;
+        lock.unlock();
+        SimPDB * pdb = new SimPDB(mIDs[i], mLen);
+        lock.lock();
+        mSlots[i % mSlots.size()] = pdb;
+        mRead.notify_all();
+    }
+}
@@ -0,0 +1,78 @@
+/*
+ *  **************************************************************************
+ *  Copyright 2026 Shuai Cheng Li and Yen Kaow Ng
+ *  **************************************************************************
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  **************************************************************************
+ * 
+ */
+
+
+
+
+#ifndef _PREFETCHER_
+#define _PREFETCHER_
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "SimpPDB.h"
+
+using namespace std;
+
+// Most decoys read ahead of the one being used
+#define PREFETCH_DEPTH 256
+
+
+/**
+ * Reads the decoys of a list, in order, ahead of their use.
+ *
+ * When the decoys are not preloaded, each SimPDB is read from its file.
+ * Background threads (PreloadedPDB::numThreads() of them) read and parse
+ * the decoys that come next in the list, so that next() seldom waits for
+ * storage. At most PREFETCH_DEPTH decoys are held that next() has not
+ * yet given out, which bounds the memory used.
+ *
+ * When the decoys are preloaded, next() only takes views of them and no
+ * threads are started.
+ */
+class Prefetcher
+{
+public:
+    Prefetcher(const vector<int>& ids, int len);
+    ~Prefetcher();
+
+    // The next decoy of the list, which the caller is to delete
+    SimPDB * next();
+
+private:
+    vector<int> mIDs;
+    int mLen;
+    vector<SimPDB *> mSlots;   // read decoys, the i-th in slot i % depth
+    size_t mNext;              // the next decoy for next() to give out
+    size_t mClaimed;           // decoys claimed by the threads so far
+    bool mStop;
+    mutex mLock;               // for all of the above
+    condition_variable mRead;  // a decoy has been read
+    condition_variable mTaken; // a decoy has been given out
+    vector<thread> mThreads;
+
+    void work();
+};
+
+#endif
@@ -22,6 +22,7 @@
 
 
 #include <iostream>
+#include <limits>
 #include <fstream>
 #include <sstream>
 
@@ -29,27 +30,64 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <iomanip>
+#include <chrono>
+#include <thread>
+#include <deque>
+#include <mutex>
+#include <algorithm>
+#include <math.h>
 
 #include "SimpPDB.h"
 #include "PreloadedPDB.h"
+#include "Decompressor.h"
+#include "Trajectory.h"
+#include "BulkReader.h"
+#include "TarArchive.h"
+#include "DecoyStream.h"
+#include "DiskAdjacency.h"
 
 using namespace std;
 
+int PreloadedPDB::NUM_THREADS = 0;
+char * PreloadedPDB::topology = NULL;
+char * PreloadedPDB::scoreColumn = (char *) "score";
+double PreloadedPDB::keepDecoys = 0;
+bool PreloadedPDB::keepPercent = false;
+
+
+/**
+ * Whether line is a MODEL record, which may or may not have a serial number
+ */
+static bool
+_is_model_record(const char * line, int len)
+{
+    return len >= 5 && !strncmp(line, "MODEL", 5)
+           && (len == 5 || line[5] == ' ');
+}
+
 
 /**
- * Reasons for choosing 36,000 as the threshold for using disk access
- * 1. 36,000 decoys of 100 residues each is about 44MB, which is still
- *    acceptable for a workstation PC. If user has less capabled hardware,
- *    the "-d" switch may be used.
- * 2. For more than 36,000 decoys, the bottleneck is probably not in disk.
+ * Whether line is one of the records which PDB files usually begin with
  */
-unsigned int PreloadedPDB::ADVISED_THRESHOLD = 36000;
+static bool
+_is_pdb_record(const char * line, int len)
+{
+    const char * records[] = {"HEADER", "TITLE ", "COMPND", "SOURCE",
+                              "KEYWDS", "EXPDTA", "AUTHOR", "REMARK",
+                              "CRYST1", "ATOM  ", "HETATM"};
+    for (int i=0; i < sizeof(records)/sizeof(records[0]); i++)
+        if (len >= 6 && !strncmp(line, records[i], 6))
+            return true;
+    return _is_model_record(line, len);
+}
 
 
 INPUT_FILE_TYPE
 filetype(char * filename)
 {
     char buf[400];
+    if (!strcmp(filename, "-"))
+        return DECOY_STREAM;
     ifstream input(filename);
     string line;
     if (!input)
@@ -58,6 +96,41 @@ filetype(char * filename)
         exit(0);
     }
 
+    // Pack files, trajectories and compressed files are binary, so look at them as such
+    MappedFile mapped(filename);
+    if (mapped.mSize >= sizeof(PackHeader)
+        && !memcmp(mapped.mData, PACK_MAGIC, sizeof(((PackHeader *) 0)->magic)))
+    {
+        input.close();
+        return PACK_FILE;
+    }
+    if (trajectory_format(mapped.mData, mapped.mSize) != NOT_TRAJECTORY)
+    {
+        input.close();
+        return TRAJECTORY_FILE;
+    }
+    if (is_tar(mapped.mData, mapped.mSize))
+    {
+        input.close();
+        return TAR_FILE;
+    }
+    if (compression(mapped.mData, mapped.mSize) != NOT_COMPRESSED)
+    {
+        // Only silent files, PDB files and tar archives may be compressed
+        char head[TAR_BLOCK];
+        Decompressor decompressor(mapped.mData, mapped.mSize, filename);
+        size_t n = decompressor.read(head, sizeof(head));
+        input.close();
+        if (n >= 9 && !strncmp(head, "SEQUENCE:", 9))
+            return SILENT_FILE;
+        if (is_tar(head, n))
+            return TAR_FILE;
+        char * newline = (char *) memchr(head, '\n', n);
+        if (_is_pdb_record(head, newline? newline - head: n))
+            return PDB_FILE;
+        return UNKNOWN;
+    }
+
     input.getline(buf, 400);
     line=buf;
     if (line.substr(0, 9)=="SEQUENCE:")
@@ -65,6 +138,11 @@ filetype(char * filename)
         input.close();
         return SILENT_FILE;
     }
+    if (_is_pdb_record(buf, strlen(buf)))
+    {
+        input.close();
+        return PDB_FILE;
+    }
 
     input.seekg(0);
     input.getline(buf, 400);
@@ -108,262 +186,1619 @@ unsigned int num_lines_in_file(char * filename)
     while (!input.eof())
     {
         input.getline(buf, 400);
+        if (input.fail() && !input.eof()) // skip the rest of a long line
+        {
+            input.clear();
+            input.ignore(numeric_limits<streamsize>::max(), '\n');
+        }
         count++;
     }
     return count-1;
 }
 
 
+/**
+ * Number of residues (i.e. selected atoms) in the first decoy of a list
+ */
+int num_residues_in_first_decoy(char * filename)
+{
+    char buf[400];
+    ifstream input(filename);
+    if (!input)
+    {
+        cerr << "Can't open input file \"" << filename << "\"" << endl;
+        exit(0);
+    }
+    input.getline(buf, 400);
+    input.close();
+    char * token = strtok(buf, " ");
+    if (token == NULL)
+        return 0;
+
+    SimPDB pdb;
+    pdb.mProteinFileName = token;
+    pdb.mNumResidue = LONGEST_CHAIN;
+    pdb.mCAlpha = new float[3*LONGEST_CHAIN];
+    return pdb.read();
+}
+
+
 //- = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = -
 
 PreloadedPDB::PreloadedPDB()
 {
+    mNames = NULL;
+    mPack = NULL;
+    mStream = NULL;
+    mStreamEnded = false;
+}
+
+/**
+ * Frees the decoys and their coordinates, but not the names, which may be
+ * shared (see loadAtoms) or have become SimPDB::decoyNames
+ */
+PreloadedPDB::~PreloadedPDB()
+{
+    for (size_t i=0; i < mPDBs.size(); i++)
+        delete mPDBs[i];
+    delete mNames;
+    delete mPack;
+    delete mStream;
 }
 
 
 /**
- * Populate the PreloadedPDB with a silentfile
+ * A SimPDB with room for len residues, bypassing the preloading mechanism
  */
-void
-PreloadedPDB::loadSilentFile(char * filename)
+static SimPDB *
+_new_SimPDB(int len)
 {
-    char buf[400];
-    ifstream input(filename);
-    string line;
-    if (!input)
+    SimPDB * pdb = new SimPDB();
+    pdb->mNumResidue = len;
+    pdb->mCAlpha = new float[3*len];
+    return pdb;
+}
+
+
+/**
+ * The field of width columns at column col of a line of length len, as
+ * the length of what there is of it (none if the line is too short)
+ */
+static inline int
+_field(int len, int col, int width)
+{
+    return len <= col? 0: (len - col < width? len - col: width);
+}
+
+/**
+ * The line at p (of length len, without line break), after which p is
+ * moved to the next line
+ */
+static inline const char *
+_next_line(const char *& p, const char * end, int& len)
+{
+    const char * line = p;
+    const char * eol = (const char *) memchr(p, '\n', end - p);
+    p = eol? eol+1: end;
+    len = (eol? eol: end) - line;
+    if (len > 0 && line[len-1] == '\r')
+        len--;
+    return line;
+}
+
+/**
+ * A decoy's score, and the offset of its SCORE: line in the silent file,
+ * which orders decoys of the same score as they are in the file
+ */
+typedef pair<float, size_t> DecoyScore;
+
+/**
+ * Keeps track of the lowest scores offered to it, up to a number of them,
+ * in a max-heap which the threads reading a silent file share. A decoy
+ * whose score does not make it into the heap is not read.
+ */
+struct ScoreFilter
+{
+    size_t keep;              // scores to keep
+    int column;               // of the score in the SCORE: lines
+    vector<DecoyScore> heap;  // the lowest scores so far, highest first
+    mutex lock;
+
+    ScoreFilter(size_t keep, int column) : keep(keep), column(column) {}
+
+    bool offer(const DecoyScore& score)
     {
-        cerr << "Can't open silent file \"" << filename << "\"" << endl;
-        exit(0);
+        lock_guard<mutex> guard(lock);
+        if (heap.size() < keep)
+        {
+            heap.push_back(score);
+            push_heap(heap.begin(), heap.end());
+            return true;
+        }
+        if (!(score < heap.front()))
+            return false;
+        pop_heap(heap.begin(), heap.end());
+        heap.back() = score;
+        push_heap(heap.begin(), heap.end());
+        return true;
     }
+};
 
-    silentfilename = filename;
-    pdblistfilename = NULL;
-
-    /**
-     * Determine the number of residues from the silent file
-     */
-    input.getline(buf, 400);
-    line=buf;
-    if (line.substr(0, 9)!="SEQUENCE:")
+/**
+ * The whitespace-separated field of a SCORE: line at column (0 for the
+ * first after "SCORE:"), of length fieldLen, which is 0 if the line is too
+ * short
+ */
+static const char *
+_score_field(const char * line, int len, int column, int& fieldLen)
+{
+    int i = 6;
+    for (int k=0; ; k++)
     {
-        cerr << "Silent file \"" << filename << "\" began with:" << endl
-             << "    " << line << endl;
-        exit(0);
+        while (i < len && isspace((unsigned char) line[i]))
+            i++;
+        int start = i;
+        while (i < len && !isspace((unsigned char) line[i]))
+            i++;
+        fieldLen = i - start;
+        if (fieldLen == 0 || k == column)
+            return line + start;
     }
+}
 
-    input.getline(buf, 400);
-    line=buf;
-    if (line.substr(0, 6)!="SCORE:")
+/**
+ * What is read from one chunk of a silent file by _read_silent_chunk()
+ */
+struct SilentChunk
+{
+    const char * begin;       // the chunk is the lines in [begin, end)...
+    const char * end;
+    vector<char> text;        // ...which are here if they are not mapped
+    vector<float> coords;     // of all its decoys
+    vector<char *> names;     // NULL where a name is to be generated
+    vector<int> numResidues;  // of each decoy, -1 if it was not read
+    size_t offset;            // of begin in the (decompressed) file
+    vector<DecoyScore> scores; // of each decoy, if filter is set
+    ScoreFilter * filter;     // to select decoys by score, or NULL
+    int errorDecoy;           // decoy with residue ids out of sequence...
+    int errorResidueID;       // ...and the offending id, or -1 if none
+    const vector<int> * atoms; // for a binary silent file (else NULL), the
+                               // selected atoms' positions in a residue
+};
+
+
+/**
+ * The values of the characters of Rosetta's 6-bit encoding (as base64, but
+ * with the bits in little-endian order), and 64 for other characters
+ */
+struct SixBitTable
+{
+    unsigned char value[256];
+
+    SixBitTable()
     {
-        cerr << "Silent file \"" << filename << "\" began with:" << endl
-             << "    " << line << endl;
-        exit(0);
+        const char * code = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                            "abcdefghijklmnopqrstuvwxyz0123456789+/";
+        memset(value, 64, sizeof(value));
+        for (int i=0; i < 64; i++)
+            value[(unsigned char) code[i]] = i;
     }
+};
+static const SixBitTable _six_bit;
 
-    input.getline(buf, 400);
-    line=buf;
-    if (line.substr(0, 6)!="SCORE:")
+/**
+ * Decode the coordinates of one atom in a residue line of a binary silent
+ * file: 12 bytes (3 floats) encoded in 16 characters, 4 characters to 3
+ * bytes. Returns false if code has characters outside the encoding.
+ */
+static inline bool
+_decode_atom(const char * code, float * xyz)
+{
+    const unsigned char * c = (const unsigned char *) code;
+    const unsigned char * v = _six_bit.value;
+    unsigned char bytes[12];
+    unsigned int bad = 0;
+    for (int i=0; i < 4; i++, c += 4)
     {
-        cerr << "Silent file \"" << filename << "\" began with:" << endl
-             << "    " << line << endl;
-        exit(0);
+        unsigned int word = v[c[0]] | v[c[1]] << 6 | v[c[2]] << 12
+                            | v[c[3]] << 18;
+        bad |= v[c[0]] | v[c[1]] | v[c[2]] | v[c[3]];
+        bytes[3*i] = word;
+        bytes[3*i+1] = word >> 8;
+        bytes[3*i+2] = word >> 16;
     }
+    memcpy(xyz, bytes, sizeof(bytes)); // floats as Rosetta wrote them
+    return !(bad & 64);
+}
+
+/**
+ * The number of atoms in a residue line of a binary silent file, which is
+ * the secondary structure, the encoded atoms, and the decoy's tag. Returns
+ * 0 for any other line (e.g. ANNOTATED_SEQUENCE: or FOLD_TREE).
+ */
+static inline int
+_binary_residue_atoms(const char * line, int len)
+{
+    const char * space = (const char *) memchr(line, ' ', len);
+    int codeLen = (space? space - line: len) - 1;
+    if (codeLen <= 0 || codeLen % 16 || !isalpha((unsigned char) line[0]))
+        return 0;
+    return codeLen / 16;
+}
 
-    int residueID;
-    for (int i=1; !input.eof(); i++)
+/**
+ * The positions of the atoms selected with -a in a residue of a binary
+ * silent file, in order. Rosetta's residue types all begin with the
+ * backbone atoms N, CA, C and O, so only these can be selected.
+ */
+static void
+_binary_silent_atoms(vector<int>& atoms, char * filename)
+{
+    const char * backbone[] = {"N", "CA", "C", "O"};
+    for (int pos=0; pos < 4; pos++)
+        for (int i=0; i < SimPDB::atom_names.size(); i++)
+            if (SimPDB::atom_names[i] == backbone[pos])
+                atoms.push_back(pos);
+    if (atoms.size() < SimPDB::atom_names.size())
     {
-        input.getline(buf, 400);
-        line = buf;
-        if (line.substr(0, 6) == "SCORE:")
-            break;
-        residueID = toInt(line.substr(1, 4));
-        if (residueID != i)
-        {
-            cerr << "Residue id " << residueID
-                 << " out of sequence in silent file" << endl; 
-            exit(0);
-        }
+        cerr << "Only atoms N, CA, C and O can be selected in binary silent"
+             << " file \"" << filename << "\"" << endl;
+        exit(0);
     }
+}
 
-    mNumResidue = residueID;
-    input.seekg(0);
-    input.getline(buf, 400);
-    input.getline(buf, 400);
-    input.getline(buf, 400);
+/**
+ * Read and center the decoys in a chunk of a silent file. Every chunk
+ * starts with the SCORE: line of its first decoy, and every SCORE: line
+ * ends the decoy before it.
+ * Reading stops at the first decoy whose residue ids are out of sequence
+ * (or, in a binary silent file, whose coordinates are corrupted); what
+ * else is wrong with the decoys is found when the chunks are put together.
+ *
+ * In a text silent file, each residue line has the C-alpha coordinates.
+ * In a binary silent file, only the atoms selected with -a (among those
+ * in chunk->atoms) and -r are decoded, and the decoy's tag is its name.
+ *
+ * With a chunk->filter, the residue lines of a decoy whose score is not
+ * among the lowest so far are skipped, and its numResidues is -1.
+ */
+static void
+_read_silent_chunk(SilentChunk * chunk)
+{
+    const char * p = chunk->begin;
+    const char * end = chunk->end;
+    const char * line;
+    int len;
+    chunk->errorDecoy = -1;
 
-    /**
-     * Read PDBs into filename2PDB
-     */
-    SimPDB * pdb = new SimPDB(mNumResidue); 
-    bool isNewPDB = true;
-    int numResidue = 0;
-    int decoyCount = 1;
-    char * key;
-    do
+    // Reserve for as many residues as there are lines, if the lines are
+    // all as long as the first few (and none are to be skipped)
+    size_t sampleBytes = end - p < 4096? end - p: 4096;
+    size_t sampleLines = 0;
+    for (const char * q = p; q < p + sampleBytes; sampleLines++)
+        _next_line(q, p + sampleBytes, len);
+    if (sampleBytes && !chunk->filter)
+        chunk->coords.reserve(3 * sampleLines * (end - p) / sampleBytes);
+
+    int numResidue = 0; // of the current decoy
+    int numSelected = 0; // atoms selected so far (for -r), if binary
+    int residueID = 0;   // residue lines so far, if binary
+    bool skip = false;   // whether the current decoy is filtered out
+    for (bool first = true; p < end; first = false)
     {
-        input.getline(buf, 400);
-        line = buf;
+        line = _next_line(p, end, len);
 
-        if (line.substr(0, 6) == "SCORE:") // Old PDB done
+        if (len >= 6 && !strncmp(line, "SCORE:", 6)) // Old PDB done
         {
-            // Check if PDB has mNumResidue
-            if (numResidue != mNumResidue)
+            if (!first)
             {
-                cerr << "Insufficient residues in the " << decoyCount
-                     << "-th decoy in silent file" << endl; 
-                exit(0);
+                if (chunk->names.size() == chunk->numResidues.size())
+                    chunk->names.push_back(NULL); // no name
+                if (numResidue > 0)
+                    center_residues(&chunk->coords[chunk->coords.size()
+                                                   - 3*numResidue],
+                                    numResidue);
+                chunk->numResidues.push_back(skip? -1: numResidue);
+                numResidue = numSelected = residueID = 0;
+            }
+            if (chunk->filter)
+            {
+                int n;
+                const char * field = _score_field(line, len,
+                                                  chunk->filter->column, n);
+                DecoyScore score(toFloat(field, n),
+                                 chunk->offset + (line - chunk->begin));
+                chunk->scores.push_back(score);
+                skip = !chunk->filter->offer(score);
+            }
+        }
+        else if (skip)
+            continue;
+        else if (chunk->atoms) // binary silent file
+        {
+            int numAtoms = _binary_residue_atoms(line, len);
+            if (numAtoms == 0)
+                continue;
+            residueID++;
+            if (chunk->names.size() == chunk->numResidues.size())
+            {
+                // The tag ends the line
+                int n = 0;
+                while (n < len && line[len-1-n] != ' ')
+                    n++;
+                chunk->names.push_back(strdup(string(line+len-n, n).c_str()));
             }
 
-            // Insert the pdb
-            filename2PDB[key] = pdb;
-            pdb->mProteinFileName = key;
-            center_residues(pdb->mCAlpha, pdb->mNumResidue);
-
-            // Start a new pdb
-            pdb = new SimPDB(mNumResidue);
-            isNewPDB = true;
-            numResidue = 0;
-
-            decoyCount++;
+            const vector<int>& atoms = *chunk->atoms;
+            bool corrupted = false;
+            for (int i=0; i < atoms.size() && atoms[i] < numAtoms; i++)
+            {
+                numSelected++;
+                if (numSelected < SimPDB::s_residue
+                    || numSelected > SimPDB::e_residue)
+                    continue;
+                size_t n = chunk->coords.size();
+                chunk->coords.resize(n+3);
+                if (!_decode_atom(line + 1 + 16*atoms[i], &chunk->coords[n]))
+                    corrupted = true;
+                numResidue++;
+            }
+            if (corrupted)
+            {
+                chunk->errorDecoy = chunk->numResidues.size();
+                chunk->errorResidueID = residueID;
+                break;
+            }
         }
-        else if (line != "") // Sometimes an empty string is read at eof
+        else if (len > 0) // Sometimes an empty string is read at eof
         {
-            if (isNewPDB)
+            if (numResidue == 0)
             {
                 // Get the filename
-                string filename = line.substr(62, 400);
-                string ext = filename.substr(filename.length()-4, 4);
+                int n = _field(len, 62, len);
+                const char * filename = line + 62;
 
-                // If filename does not end in .pdb, generate a filename
-                if (strcmp(ext.c_str(), ".pdb"))
-                    key = strdup("decoy" + decoyCount);
+                // If filename does not end in .pdb, a name is generated
+                if (n < 4 || strncmp(filename + n-4, ".pdb", 4))
+                    chunk->names.push_back(NULL);
                 else
-                    key = strdup(filename.c_str());
-
-                isNewPDB = false;
+                    chunk->names.push_back(strdup(string(filename, n).c_str()));
             }
 
-            residueID = toInt(line.substr( 0, 4));
-            float x = toFloat(line.substr(35, 8));
-            float y = toFloat(line.substr(44, 9));
-            float z = toFloat(line.substr(54, 8));
-            pdb->mCAlpha[numResidue*3]   = x;
-            pdb->mCAlpha[numResidue*3+1] = y;
-            pdb->mCAlpha[numResidue*3+2] = z;
-
+            int residueID = toInt(line, _field(len, 0, 4));
             if (residueID != numResidue+1)
             {
-                cout << residueID << "," << numResidue << endl;
-                cerr << "Residue ID out of sequence in the " << decoyCount
-                     << "-th decoy in silent file" << endl; 
-                exit(0);
+                chunk->errorDecoy = chunk->numResidues.size();
+                chunk->errorResidueID = residueID;
+                break;
             }
-
+            chunk->coords.push_back(toFloat(line+35, _field(len, 35, 8)));
+            chunk->coords.push_back(toFloat(line+44, _field(len, 44, 9)));
+            chunk->coords.push_back(toFloat(line+54, _field(len, 54, 8)));
             numResidue++;
         }
-
     }
-    while (!input.eof());
-    input.close();
-
-    // Insert the final pdb
-    filename2PDB[key] = pdb;
-    pdb->mProteinFileName = key;
-
-    mNumDecoy = decoyCount;
+    // The final decoy has no SCORE line after it
+    if (numResidue == 0 && chunk->names.size() == chunk->numResidues.size())
+        chunk->names.push_back(NULL);
+    else if (numResidue > 0)
+        center_residues(&chunk->coords[chunk->coords.size() - 3*numResidue],
+                        numResidue);
+    chunk->numResidues.push_back(skip? -1: numResidue);
+}
 
-    /**
-     * Generate the vector of filenames.
-     * We can insert filename at the same time as inserting the SimPDB into
-     * filename2PDB. However, doing this here has the advantage that if the
-     * same filename is entered twice into filename2PDB, the name will not
-     * be duplicated here.
-     */
-    mNames = new vector<char *>(0); 
-    map<char *,SimPDB *>::iterator it = filename2PDB.begin();
-    for (int i=0; it != filename2PDB.end(); it++, i++)
-        mNames->push_back( it->first );
+/**
+ * Skip the header lines of a silent file at p, checking them, up to the
+ * SCORE: line of the first decoy. These are two lines and that SCORE:
+ * line, except that a binary silent file has a REMARK BINARY SILENTFILE
+ * line before its first decoy, by which binary is set.
+ * If filter is set, its column is set to that of the score named
+ * PreloadedPDB::scoreColumn in the header.
+ * Returns false if there are not yet enough whole lines before end
+ */
+static bool
+_skip_silent_header(const char *& p, const char * end, bool atEOF,
+                    char * filename, bool& binary, ScoreFilter * filter)
+{
+    const char * q = p;
+    const char * first = p; // the SCORE: line of the first decoy
+    const char * header[3] = {"SEQUENCE:", "SCORE:", "SCORE:"};
+    binary = false;
+    for (int i=0; i < 3; i++)
+    {
+        if (!atEOF && !memchr(q, '\n', end - q))
+            return false;
+        int len;
+        first = q;
+        const char * line = _next_line(q, end, len);
+        if (i == 2 && len >= 13 && !strncmp(line, "REMARK BINARY", 13))
+        {
+            binary = true;
+            i--;
+            continue;
+        }
+        if (len < strlen(header[i]) || strncmp(line, header[i], strlen(header[i])))
+        {
+            cerr << "Silent file \"" << filename << "\" began with:" << endl
+                 << "    " << string(line, len) << endl;
+            exit(0);
+        }
+        if (i == 1 && filter)
+        {
+            const char * name = PreloadedPDB::scoreColumn;
+            int n;
+            for (filter->column = 0; ; filter->column++)
+            {
+                const char * field = _score_field(line, len, filter->column,
+                                                  n);
+                if (n == 0 || (n == strlen(name) && !strncmp(field, name, n)))
+                    break;
+            }
+            if (n == 0)
+            {
+                cerr << "No score \"" << name << "\" in silent file \""
+                     << filename << "\"" << endl;
+                exit(0);
+            }
+        }
+    }
+    p = first;
+    return true;
 }
 
+/**
+ * The number of SCORE: lines, but for one on the first line, in [p, end)
+ */
+static size_t
+_count_score_lines(const char * p, const char * end)
+{
+    size_t count = 0;
+    while ((p = (const char *) memmem(p, end - p, "\nSCORE:", 7)))
+        p++, count++;
+    return count;
+}
 
 /**
- * Populate the PreloadedPDB with the PDB files specified in a list.
- *
- * Reading of the PDB files is through SimPDB.
+ * The number of decoys in a silent file (which may be compressed), which
+ * is one less than the number of its SCORE: lines
  */
-void
-PreloadedPDB::loadPDBFromList(char * filename)
+static size_t
+_count_silent_decoys(const char * data, size_t size, char * filename)
 {
-    ifstream input(filename);
-    if (!input)
+    size_t count = 0;
+    if (compression(data, size) == NOT_COMPRESSED)
+        count = _count_score_lines(data, data + size);
+    else
     {
-        cerr << "Cannot find file \"" << filename << "\"" << endl;
-        exit(0);
+        // Each block begins with the last bytes of the one before, for a
+        // line break and SCORE: across blocks
+        Decompressor input(data, size, filename);
+        vector<char> block(6 + SILENT_BLOCK_BYTES);
+        size_t carry = 0;
+        for (;;)
+        {
+            size_t n = input.read(&block[carry], SILENT_BLOCK_BYTES);
+            const char * end = &block[0] + carry + n;
+            count += _count_score_lines(&block[0], end);
+            if (n < SILENT_BLOCK_BYTES)
+                break;
+            carry = 6;
+            memmove(&block[0], end - carry, carry);
+        }
     }
+    return count > 0? count - 1: 0;
+}
 
-    char buf[400];
-    char* token;
+/**
+ * The number of threads to load decoys on (see NUM_THREADS)
+ */
+int
+PreloadedPDB::numThreads()
+{
+    int numThreads = NUM_THREADS > 0? NUM_THREADS:
+                     thread::hardware_concurrency();
+    return numThreads < 1? 1: numThreads;
+}
 
-    silentfilename = NULL;
-    pdblistfilename = filename;
+/**
+ * Read the decoys of a mapped silent file into chunks. The file is split
+ * into one chunk per thread, each of which begins at a SCORE: line.
+ */
+static void
+_read_mapped_silent_file(const char * data, size_t size, char * filename,
+                         vector<SilentChunk *>& chunks, ScoreFilter * filter)
+{
+    const char * p = data;
+    const char * end = data + size;
+    bool binary;
+    vector<int> atoms;
+    _skip_silent_header(p, end, true, filename, binary, filter);
+    if (binary)
+        _binary_silent_atoms(atoms, filename);
 
-    /**
-     * Read in names of PDB files
-     */
-    mNames = new vector<char *>(0); 
-    while (!input.eof())
+    size_t numChunks = (end - p) / MIN_SILENT_CHUNK_BYTES + 1;
+    if (numChunks > (size_t) PreloadedPDB::numThreads())
+        numChunks = PreloadedPDB::numThreads();
+    chunks.push_back(new SilentChunk());
+    chunks[0]->begin = p;
+    for (size_t i=1; i < numChunks; i++)
     {
-        input.getline(buf, 400);
-        token = strtok(buf, " ");
-        if (token == NULL)
-            continue;
-        char * name = new char[strlen(token)+1];
-        strcpy(name, token);
-        mNames->push_back(name);
+        const char * q = p + (end - p) * i / numChunks;
+        if (q < chunks.back()->begin)
+            q = chunks.back()->begin;
+        // go to the next SCORE: line
+        q = (const char *) memchr(q, '\n', end - q);
+        while (q && end - q > 6 && strncmp(q+1, "SCORE:", 6))
+            q = (const char *) memchr(q+1, '\n', end - q - 1);
+        if (!q || end - q <= 6)
+            break;
+        chunks.back()->end = q+1;
+        chunks.push_back(new SilentChunk());
+        chunks.back()->begin = q+1;
     }
-    input.close();
-
-    mNumDecoy = mNames->size();
+    chunks.back()->end = end;
 
-    SimPDB * pdb = new SimPDB();
-    pdb->mProteinFileName = (*mNames)[0];
-    pdb->mNumResidue = LONGEST_CHAIN;
-    pdb->mCAlpha = new float[3*LONGEST_CHAIN];
-    int count = pdb->read();
-    if (count <= 0)
+    vector<thread> threads;
+    for (size_t i=0; i < chunks.size(); i++)
     {
-        cout << "Error: no residue in decoy file \"" << (*mNames)[0] << "\""
-             << endl;
-        exit(0);
+        chunks[i]->atoms = binary? &atoms: NULL;
+        chunks[i]->filter = filter;
+        chunks[i]->offset = chunks[i]->begin - data;
+        threads.push_back(thread(_read_silent_chunk, chunks[i]));
     }
+    for (size_t i=0; i < threads.size(); i++)
+        threads[i].join();
+}
 
-    mNumResidue = pdb->mNumResidue;
-    cout << "Specifications result in " << mNumResidue << " atoms" << endl;
-
-    filename2PDB[(*mNames)[0]] = pdb;
-
-    for (int i=1; i < mNames->size(); i++)
+/**
+ * Read the decoys of a compressed silent file into chunks. The file is
+ * decompressed on this thread, and every MIN_SILENT_CHUNK_BYTES or so of
+ * it, cut at a SCORE: line, is read on another thread in the meantime.
+ * Returns the size of the decompressed file.
+ */
+static size_t
+_read_compressed_silent_file(const char * data, size_t size, char * filename,
+                             vector<SilentChunk *>& chunks,
+                             ScoreFilter * filter)
+{
+    Decompressor input(data, size, filename);
+    size_t total = 0;
+    size_t offset = 0;      // where the decoys begin in the current chunk
+    bool inHeader = true;
+    bool binary = false;
+    vector<int> atoms;      // selected, if binary
+    deque<thread> threads;  // of the latest chunks, in order
+    SilentChunk * chunk = new SilentChunk();
+    for (;;)
     {
-        SimPDB * pdb = new SimPDB(mNumResidue);
-        pdb->mProteinFileName = (*mNames)[i];
-        int count = pdb->read();
-        if (count != mNumResidue)
+        vector<char>& text = chunk->text;
+        size_t n = text.size();
+        text.resize(n + SILENT_BLOCK_BYTES);
+        n += input.read(&text[n], SILENT_BLOCK_BYTES);
+        bool atEOF = n < text.size();
+        total += n - (text.size() - SILENT_BLOCK_BYTES);
+        text.resize(n);
+
+        if (inHeader)
         {
-            cout << "Error: \"" << (*mNames)[i] << "\" "
-                 << "has mismatching number of residues"
-                 << " (should have " << mNumResidue << " but has only "
-                 << count << ")" << endl;
-            exit(0);
+            const char * p = text.empty()? "": &text[0];
+            if (!_skip_silent_header(p, p + n, atEOF, filename, binary,
+                                     filter))
+                continue;
+            if (binary)
+                _binary_silent_atoms(atoms, filename);
+            offset = p - &text[0];
+            inHeader = false;
         }
-        filename2PDB[(*mNames)[i]] = pdb;
-    }
-}
 
+        // Cut the chunk at the last SCORE: line (the rest is for the next
+        // chunk), once it is large enough
+        size_t cut = n;
+        if (!atEOF)
+        {
+            if (n - offset < MIN_SILENT_CHUNK_BYTES)
+                continue;
+            for (cut = n-7; cut > offset; cut--)
+                if (text[cut] == '\n' && !strncmp(&text[cut+1], "SCORE:", 6))
+                    break;
+            if (cut <= offset) // one long decoy
+                continue;
+            cut++;
+        }
+        SilentChunk * next = new SilentChunk();
+        next->text.assign(text.begin() + cut, text.end());
+        text.resize(cut);
+        chunk->begin = text.empty()? "": &text[0] + offset;
+        chunk->end = chunk->begin + (cut - offset);
+        chunk->atoms = binary? &atoms: NULL;
+        chunk->filter = filter;
+        chunk->offset = total - n + offset;
 
-SimPDB *
-PreloadedPDB::getSimPDB(char * filename)
+        if (threads.size() == (size_t) PreloadedPDB::numThreads())
+        {
+            threads.front().join();
+            vector<char>().swap(chunks[chunks.size() - threads.size()]->text);
+            threads.pop_front();
+        }
+        threads.push_back(thread(_read_silent_chunk, chunk));
+        chunks.push_back(chunk);
+
+        if (atEOF)
+        {
+            delete next;
+            break;
+        }
+        chunk = next;
+        offset = 0;
+    }
+    for (size_t i=0; i < threads.size(); i++)
+    {
+        threads[i].join();
+        vector<char>().swap(chunks[chunks.size() - threads.size() + i]->text);
+    }
+    return total;
+}
+
+/**
+ * Populate the PreloadedPDB with a silentfile, which may be compressed.
+ *
+ * The decoys are read in chunks, on up to NUM_THREADS threads, and the
+ * decoys of each chunk go into a block of mStore. The first decoy
+ * determines the number of residues.
+ *
+ * If keepDecoys is set, only that many decoys (or that percentage of the
+ * decoys) of the lowest score in column scoreColumn are kept. The readers
+ * share the lowest scores so far (see ScoreFilter), and skip the decoys
+ * which cannot be kept, which are then never read. Of the decoys read,
+ * those which later turn out not to be among the lowest are left out when
+ * the chunks are put together.
+ */
+void
+PreloadedPDB::loadSilentFile(char * filename)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    MappedFile input(filename);
+    if (!input.isOpen())
+    {
+        cerr << "Can't open silent file \"" << filename << "\"" << endl;
+        exit(0);
+    }
+
+    silentfilename = filename;
+    pdblistfilename = NULL;
+
+    ScoreFilter * filter = NULL;
+    if (keepDecoys > 0)
+    {
+        size_t keep = keepDecoys;
+        if (keepPercent)
+            keep = ceil(_count_silent_decoys(input.mData, input.mSize,
+                                             filename) * keepDecoys / 100);
+        filter = new ScoreFilter(keep > 0? keep: 1, 0);
+    }
+
+    vector<SilentChunk *> chunks;
+    size_t size = input.mSize;
+    bool compressed = compression(input.mData, input.mSize) != NOT_COMPRESSED;
+    if (compressed)
+        size = _read_compressed_silent_file(input.mData, input.mSize,
+                                            filename, chunks, filter);
+    else
+        _read_mapped_silent_file(input.mData, input.mSize, filename, chunks,
+                                 filter);
+
+    // Of the decoys read, keep those which are still in the heap
+    DecoyScore cutoff(0, 0);
+    if (filter && !filter->heap.empty())
+        cutoff = filter->heap.front();
+
+    /**
+     * Put the decoys of the chunks together, in order
+     */
+    mNames = new vector<char *>(0);
+    mNumResidue = 0;
+    int firstDecoy = 1; // the first decoy read, which mNumResidue is of
+    for (size_t i=0; i < chunks.size() && mNumResidue == 0; i++)
+        for (int j=0; j < chunks[i]->numResidues.size(); j++, firstDecoy++)
+            if (chunks[i]->numResidues[j] >= 0)
+            {
+                mNumResidue = chunks[i]->numResidues[j];
+                break;
+            }
+    mStore.resize(chunks.size());
+    int decoyCount = 1;
+    for (size_t i=0; i < chunks.size(); i++)
+    {
+        SilentChunk& chunk = *chunks[i];
+        mStore[i].swap(chunk.coords);
+        float * coords = mStore[i].empty()? NULL: &mStore[i][0];
+        size_t numRead = 0; // decoys of the chunk read so far
+        for (int j=0; j < chunk.numResidues.size(); j++, decoyCount++)
+        {
+            int numResidue = chunk.numResidues[j];
+            if (numResidue < 0) // filtered out unread
+                continue;
+            if (j == chunk.errorDecoy && chunk.atoms) // binary
+            {
+                cerr << "Corrupted coordinates in residue "
+                     << chunk.errorResidueID << " of the " << decoyCount
+                     << "-th decoy in silent file" << endl;
+                exit(0);
+            }
+            // A decoy which stopped at an error with all its residues read
+            // went on for too long
+            if (decoyCount > firstDecoy && (numResidue > mNumResidue
+                    || (j == chunk.errorDecoy && numResidue == mNumResidue)))
+            {
+                cerr << "Too many residues in the " << decoyCount
+                     << "-th decoy in silent file" << endl;
+                exit(0);
+            }
+            if (j == chunk.errorDecoy)
+            {
+                cout << chunk.errorResidueID << "," << numResidue << endl;
+                cerr << "Residue ID out of sequence in the " << decoyCount
+                     << "-th decoy in silent file" << endl; 
+                exit(0);
+            }
+            if (numResidue != mNumResidue || numResidue == 0)
+            {
+                cerr << "Insufficient residues in the " << decoyCount
+                     << "-th decoy in silent file" << endl; 
+                exit(0);
+            }
+
+            float * decoy = coords + (size_t) 3*mNumResidue*numRead++;
+            if (filter && cutoff < chunk.scores[j])
+            {
+                free(chunk.names[j]);
+                continue;
+            }
+
+            char * name = chunk.names[j];
+            if (name == NULL)
+            {
+                char generated[32];
+                sprintf(generated, "decoy%d", decoyCount);
+                name = strdup(generated);
+            }
+            SimPDB * pdb = new SimPDB();
+            pdb->mDecoyID = mPDBs.size();
+            pdb->mProteinFileName = name;
+            pdb->mNumResidue = mNumResidue;
+            pdb->mCAlpha = decoy;
+            pdb->mOwnsCAlpha = false; // owned by mStore
+            mPDBs.push_back(pdb);
+            mNames->push_back(name);
+        }
+        delete chunks[i];
+    }
+    mNumDecoy = mPDBs.size();
+    if (filter)
+    {
+        cout << "Kept the " << mNumDecoy << " decoys of lowest \""
+             << scoreColumn << "\" (at most " << cutoff.first << ") of "
+             << decoyCount - 1 << " in silent file" << endl;
+        delete filter;
+    }
+
+    int numThreads = PreloadedPDB::numThreads();
+    if (chunks.size() < numThreads)
+        numThreads = chunks.size();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now()
+                                              - start).count();
+    double mb = size / (1024.0*1024.0);
+    cout << "Read " << mNumDecoy << " decoys of " << mNumResidue
+         << " residues from " << (compressed? "compressed ": "")
+         << "silent file on " << numThreads
+         << (numThreads > 1? " threads": " thread") << " (" << mb
+         << " MB in " << seconds << " s, "
+         << (seconds > 0? mb/seconds: 0) << " MB/s)" << endl;
+}
+
+
+/**
+ * The names of the decoy files in a list, one per line
+ */
+static vector<char *> *
+_read_decoy_list(char * filename)
+{
+    ifstream input(filename);
+    if (!input)
+    {
+        cerr << "Cannot find file \"" << filename << "\"" << endl;
+        exit(0);
+    }
+
+    char buf[400];
+    char* token;
+
+    vector<char *> * names = new vector<char *>(0);
+    while (!input.eof())
+    {
+        input.getline(buf, 400);
+        if (input.fail() && !input.eof()) // skip the rest of a long line
+        {
+            input.clear();
+            input.ignore(numeric_limits<streamsize>::max(), '\n');
+        }
+        token = strtok(buf, " ");
+        if (token == NULL)
+            continue;
+        char * name = new char[strlen(token)+1];
+        strcpy(name, token);
+        names->push_back(name);
+    }
+    input.close();
+    return names;
+}
+
+
+/**
+ * Read the first decoy of a list, which determines the number of residues
+ */
+static SimPDB *
+_read_first_decoy(char * filename)
+{
+    SimPDB * pdb = _new_SimPDB(LONGEST_CHAIN);
+    pdb->mDecoyID = 0;
+    pdb->mProteinFileName = filename;
+    int count = pdb->read();
+    if (count <= 0)
+    {
+        cout << "Error: no residue in decoy file \"" << filename << "\""
+             << endl;
+        exit(0);
+    }
+    cout << "Specifications result in " << pdb->mNumResidue << " atoms"
+         << endl;
+    return pdb;
+}
+
+
+/**
+ * Populate the PreloadedPDB with the PDB files specified in a list.
+ *
+ * The first file is read through SimPDB, to determine the number of
+ * residues; the others are read in bulk (see BulkReader) and parsed on up
+ * to NUM_THREADS threads.
+ */
+void
+PreloadedPDB::loadPDBFromList(char * filename)
+{
+    silentfilename = NULL;
+    pdblistfilename = filename;
+    mNames = _read_decoy_list(filename);
+
+    if (SimPDB::multiModel) // each file holds a number of models
+    {
+        vector<char *> * files = mNames;
+        mNames = new vector<char *>(0);
+        mNumResidue = 0;
+        for (int i=0; i < files->size(); i++)
+            loadModels((*files)[i]);
+        return;
+    }
+
+    mNumDecoy = mNames->size();
+
+    SimPDB * pdb = _read_first_decoy((*mNames)[0]);
+    mNumResidue = pdb->mNumResidue;
+    mPDBs.resize(mNames->size());
+    mPDBs[0] = pdb;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<int> counts(mNames->size());
+    BulkReader reader(*mNames, 1, mNames->size());
+    int numThreads = PreloadedPDB::numThreads();
+    reader.read([&](size_t i, const char * data, size_t size) {
+        SimPDB * pdb = _new_SimPDB(mNumResidue);
+        pdb->mDecoyID = i;
+        pdb->mProteinFileName = (*mNames)[i];
+        counts[i] = pdb->parse(data, size);
+        mPDBs[i] = pdb;
+    }, numThreads);
+
+    for (int i=1; i < mNames->size(); i++)
+    {
+        if (counts[i] != mNumResidue)
+        {
+            cout << "Error: \"" << (*mNames)[i] << "\" "
+                 << "has mismatching number of residues"
+                 << " (should have " << mNumResidue << " but has only "
+                 << counts[i] << ")" << endl;
+            exit(0);
+        }
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now()
+                                              - start).count();
+    double mb = reader.mBytes / (1024.0*1024.0);
+    int numFiles = mNames->size() - 1;
+    if (numFiles > 0)
+        cout << "Read " << numFiles << " more decoy files on " << numThreads
+             << (numThreads > 1? " threads": " thread")
+             << (reader.mIoUring? " through io_uring": "") << " (" << mb
+             << " MB in " << seconds << " s, "
+             << (seconds > 0? numFiles/seconds: 0) << " files/s, "
+             << (seconds > 0? mb/seconds: 0) << " MB/s)" << endl;
+}
+
+
+
+/**
+ * The text of the PDB file mapped by input, decompressed into text if the
+ * file is compressed
+ */
+static const char *
+_pdb_text(const char * filename, MappedFile& input, vector<char>& text,
+          size_t& size)
+{
+    if (!input.isOpen())
+    {
+        cerr << "Cannot find protein file " << filename << endl;
+        exit(0);
+    }
+    if (compression(input.mData, input.mSize) == NOT_COMPRESSED)
+    {
+        size = input.mSize;
+        return input.mData;
+    }
+    Decompressor(input.mData, input.mSize, filename).readAll(text);
+    size = text.size();
+    return text.empty()? "": &text[0];
+}
+
+
+/**
+ * Populate the PreloadedPDB with the models in a PDB file
+ */
+void
+PreloadedPDB::loadPDBFile(char * filename)
+{
+    silentfilename = NULL;
+    pdblistfilename = NULL;
+    mNames = new vector<char *>(0);
+    mNumResidue = 0;
+    loadModels(filename);
+}
+
+
+/**
+ * Add every model in a PDB file (which may be compressed) as a decoy named
+ * file#model. A model begins at a MODEL record, or at an ATOM record
+ * outside of any model, as in a file without MODEL records. The file is
+ * read in one pass, and the models go into one block of mStore.
+ *
+ * If mNumResidue is 0, the first model determines the number of residues.
+ */
+void
+PreloadedPDB::loadModels(char * filename)
+{
+    MappedFile input(filename);
+    vector<char> text;
+    size_t size;
+    const char * data = _pdb_text(filename, input, text, size);
+
+    mStore.push_back(vector<float>());
+    vector<float>& block = mStore.back();
+    vector<char *> names;
+    const char * p = data;
+    const char * end = data + size;
+    int numModels = 0;
+    while (p < end)
+    {
+        const char * model = p;
+        int len;
+        const char * line = _next_line(p, end, len);
+        bool isModel = _is_model_record(line, len);
+        if (!isModel && !(len >= 6 && (!strncmp(line, "ATOM  ", 6)
+                                       || !strncmp(line, "HETATM", 6))))
+            continue;
+        numModels++;
+
+        // Name the decoy after the model's serial number, if it has one
+        int serial = isModel? toInt(line+6, len-6): 0;
+        char * name = new char[strlen(filename) + 16];
+        sprintf(name, "%s#%d", filename, serial > 0? serial: numModels);
+        if (!isModel)
+            p = model; // this line is already part of the model
+
+        int room = mNumResidue > 0? mNumResidue: LONGEST_CHAIN;
+        size_t offset = block.size();
+        block.resize(offset + 3*room);
+        size_t used;
+        int count = parse_pdb(p, end - p, &block[offset], room, &used);
+        p += used;
+        if (mNumResidue == 0)
+        {
+            if (count <= 0)
+            {
+                cout << "Error: no residue in decoy \"" << name << "\""
+                     << endl;
+                exit(0);
+            }
+            mNumResidue = count < room? count: room;
+            cout << "Specifications result in " << mNumResidue << " atoms"
+                 << endl;
+        }
+        if (count != mNumResidue)
+        {
+            cout << "Error: \"" << name << "\" "
+                 << "has mismatching number of residues"
+                 << " (should have " << mNumResidue << " but has "
+                 << count << ")" << endl;
+            exit(0);
+        }
+        block.resize(offset + 3*count);
+        center_residues(&block[offset], count);
+        names.push_back(name);
+
+        // parse_pdb() stops at the end of the model, or earlier at a TER.
+        // Skip what is left of the model, but not the next model
+        while (p < end)
+        {
+            const char * q = p;
+            line = _next_line(q, end, len);
+            if (_is_model_record(line, len))
+                break;
+            p = q;
+            if (len >= 6 && !strncmp(line, "ENDMDL", 6))
+                break;
+        }
+    }
+
+    for (int i=0; i < names.size(); i++)
+    {
+        SimPDB * pdb = new SimPDB();
+        pdb->mDecoyID = mPDBs.size();
+        pdb->mProteinFileName = names[i];
+        pdb->mNumResidue = mNumResidue;
+        pdb->mCAlpha = &block[(size_t) 3*mNumResidue*i];
+        pdb->mOwnsCAlpha = false; // owned by mStore
+        mPDBs.push_back(pdb);
+        mNames->push_back(names[i]);
+    }
+    mNumDecoy = mPDBs.size();
+}
+
+
+/**
+ * Populate the PreloadedPDB with decoys from the standard input (see
+ * DecoyStream), which are read on a background thread. Returns once
+ * numDecoys decoys have arrived, or all of them if numDecoys is 0, or the
+ * stream has ended. May be called again to take in the decoys which have
+ * arrived since, so that the first decoys can be used while the rest are
+ * still being generated.
+ */
+void
+PreloadedPDB::loadStream(size_t numDecoys)
+{
+    if (mStream == NULL)
+    {
+        silentfilename = NULL;
+        pdblistfilename = NULL;
+        mNames = new vector<char *>(0);
+        mStream = new DecoyStream(stdin);
+    }
+    if (mStreamEnded)
+        return;
+    mStreamEnded = mStream->take(numDecoys, mPDBs, *mNames);
+    mNumResidue = mStream->numResidues();
+    mNumDecoy = mPDBs.size();
+    if (mNumDecoy == 0)
+    {
+        cout << "Error: no decoys in the decoy stream" << endl;
+        exit(0);
+    }
+    cout << "Read " << mNumDecoy << " decoys"
+         << (mStreamEnded? "": " so far") << " from the decoy stream"
+         << endl;
+}
+
+
+/**
+ * Populate the PreloadedPDB with some of the atoms of the decoys of
+ * another, given by their indices among the atoms of a decoy (see
+ * SimPDB::selections). The atoms are copied into one block of mStore, and
+ * centered anew.
+ */
+void
+PreloadedPDB::loadAtoms(PreloadedPDB * from, const vector<int>& atoms)
+{
+    silentfilename = NULL;
+    pdblistfilename = NULL;
+    mNames = new vector<char *>(*from->mNames);
+    mNumResidue = atoms.size();
+    mStore.push_back(vector<float>((size_t) 3*mNumResidue*from->mPDBs.size()));
+    vector<float>& block = mStore.back();
+    for (int i=0; i < from->mPDBs.size(); i++)
+    {
+        const float * source = from->mPDBs[i]->mCAlpha;
+        float * coords = &block[(size_t) 3*mNumResidue*i];
+        for (int k=0; k < mNumResidue; k++)
+            memcpy(coords + 3*k, source + 3*atoms[k], 3*sizeof(float));
+        center_residues(coords, mNumResidue);
+
+        SimPDB * pdb = new SimPDB();
+        pdb->mDecoyID = i;
+        pdb->mProteinFileName = from->mPDBs[i]->mProteinFileName;
+        pdb->mNumResidue = mNumResidue;
+        pdb->mCAlpha = coords;
+        pdb->mOwnsCAlpha = false; // owned by mStore
+        mPDBs.push_back(pdb);
+    }
+    mNumDecoy = mPDBs.size();
+}
+
+
+/**
+ * Populate the PreloadedPDB with the decoy files in a tar archive (which
+ * may be compressed), each a decoy named by its path in the archive. The
+ * members are parsed in place, on up to NUM_THREADS threads, into one
+ * block of mStore. The first member determines the number of residues.
+ */
+void
+PreloadedPDB::loadTarFile(char * filename)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    MappedFile input(filename);
+    vector<char> text;
+    size_t size;
+    const char * data = _pdb_text(filename, input, text, size);
+    vector<TarMember> members;
+    read_tar(data, size, filename, members);
+    if (members.empty())
+    {
+        cerr << "No decoy files in tar archive \"" << filename << "\""
+             << endl;
+        exit(0);
+    }
+
+    silentfilename = NULL;
+    pdblistfilename = NULL;
+    mNames = new vector<char *>(0);
+    for (size_t i=0; i < members.size(); i++)
+        mNames->push_back(strdup(members[i].name.c_str()));
+
+    SimPDB * first = _new_SimPDB(LONGEST_CHAIN);
+    first->mProteinFileName = (*mNames)[0];
+    if (first->parse(members[0].data, members[0].size) <= 0)
+    {
+        cout << "Error: no residue in decoy file \"" << (*mNames)[0] << "\""
+             << endl;
+        exit(0);
+    }
+    mNumResidue = first->mNumResidue;
+    cout << "Specifications result in " << mNumResidue << " atoms" << endl;
+    delete first;
+
+    mStore.push_back(vector<float>((size_t) 3*mNumResidue*members.size()));
+    vector<float>& block = mStore.back();
+    for (size_t i=0; i < members.size(); i++)
+    {
+        SimPDB * pdb = new SimPDB();
+        pdb->mDecoyID = mPDBs.size();
+        pdb->mProteinFileName = (*mNames)[i];
+        pdb->mNumResidue = mNumResidue;
+        pdb->mCAlpha = &block[(size_t) 3*mNumResidue*i];
+        pdb->mOwnsCAlpha = false; // owned by mStore
+        mPDBs.push_back(pdb);
+    }
+    mNumDecoy = mPDBs.size();
+
+    // Each thread parses a range of the members
+    vector<int> counts(members.size());
+    size_t numThreads = PreloadedPDB::numThreads();
+    if (numThreads > members.size())
+        numThreads = members.size();
+    vector<thread> threads;
+    for (size_t t=0; t < numThreads; t++)
+        threads.push_back(thread([&](size_t t) {
+            size_t end = members.size() * (t+1) / numThreads;
+            for (size_t i = members.size() * t / numThreads; i < end; i++)
+                counts[i] = mPDBs[i]->parse(members[i].data, members[i].size);
+        }, t));
+    for (size_t t=0; t < threads.size(); t++)
+        threads[t].join();
+
+    for (size_t i=0; i < members.size(); i++)
+    {
+        if (counts[i] != mNumResidue)
+        {
+            cout << "Error: \"" << (*mNames)[i] << "\" "
+                 << "has mismatching number of residues"
+                 << " (should have " << mNumResidue << " but has "
+                 << counts[i] << ")" << endl;
+            exit(0);
+        }
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now()
+                                              - start).count();
+    double mb = size / (1024.0*1024.0);
+    cout << "Read " << mNumDecoy << " decoys from "
+         << (text.empty()? "": "compressed ") << "tar archive on "
+         << numThreads << (numThreads > 1? " threads": " thread") << " ("
+         << mb << " MB in " << seconds << " s, "
+         << (seconds > 0? mNumDecoy/seconds: 0) << " files/s, "
+         << (seconds > 0? mb/seconds: 0) << " MB/s)" << endl;
+}
+
+
+/**
+ * Populate the PreloadedPDB with the frames of a DCD or XTC trajectory,
+ * each a decoy named file#frame. The atoms are selected in the topology
+ * PDB file, and the frames are read one at a time, the selected atoms of
+ * each going straight into one block of mStore.
+ */
+void
+PreloadedPDB::loadTrajectory(char * filename)
 {
-    return filename2PDB[filename];
+    if (topology == NULL)
+    {
+        cerr << "A trajectory needs a topology PDB file (see --top)" << endl;
+        exit(0);
+    }
+    silentfilename = NULL;
+    pdblistfilename = NULL;
+    mNames = new vector<char *>(0);
+
+    // Find where the selected atoms are in the trajectory's frames
+    vector<int> atoms(LONGEST_CHAIN);
+    {
+        MappedFile input(topology);
+        vector<char> text;
+        size_t size;
+        const char * data = _pdb_text(topology, input, text, size);
+        vector<float> coords(3*LONGEST_CHAIN);
+        int count = is_cif(data, size)?
+                    parse_cif(data, size, &coords[0], LONGEST_CHAIN, NULL,
+                              &atoms[0]):
+                    parse_pdb(data, size, &coords[0], LONGEST_CHAIN, NULL,
+                              &atoms[0]);
+        if (count <= 0)
+        {
+            cout << "Error: no residue in topology file \"" << topology
+                 << "\"" << endl;
+            exit(0);
+        }
+        mNumResidue = count < LONGEST_CHAIN? count: LONGEST_CHAIN;
+        cout << "Specifications result in " << mNumResidue << " atoms"
+             << endl;
+    }
+
+    Trajectory trajectory(filename);
+    int numAtoms = trajectory.numAtoms();
+    if (atoms[mNumResidue-1] >= numAtoms)
+    {
+        cout << "Error: \"" << filename << "\" has only " << numAtoms
+             << " atoms, fewer than topology \"" << topology << "\""
+             << endl;
+        exit(0);
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    mStore.push_back(vector<float>());
+    vector<float>& block = mStore.back();
+    vector<float> frame(3*numAtoms);
+    while (trajectory.next(&frame[0]))
+    {
+        size_t offset = block.size();
+        block.resize(offset + 3*mNumResidue);
+        float * coords = &block[offset];
+        for (int i=0; i < mNumResidue; i++)
+            memcpy(coords + 3*i, &frame[3*atoms[i]], 3*sizeof(float));
+        center_residues(coords, mNumResidue);
+    }
+
+    int numFrames = block.size() / (3*mNumResidue);
+    if (numFrames == 0)
+    {
+        cout << "Error: no frame in trajectory \"" << filename << "\""
+             << endl;
+        exit(0);
+    }
+    for (int i=0; i < numFrames; i++)
+    {
+        char * name = new char[strlen(filename) + 16];
+        sprintf(name, "%s#%d", filename, i+1);
+        SimPDB * pdb = new SimPDB();
+        pdb->mDecoyID = i;
+        pdb->mProteinFileName = name;
+        pdb->mNumResidue = mNumResidue;
+        pdb->mCAlpha = &block[(size_t) 3*mNumResidue*i];
+        pdb->mOwnsCAlpha = false; // owned by mStore
+        mPDBs.push_back(pdb);
+        mNames->push_back(name);
+    }
+    mNumDecoy = numFrames;
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now()
+                                              - start).count();
+    cout << "Read " << numFrames << " frames of " << numAtoms
+         << " atoms from trajectory (" << seconds << " s, "
+         << (seconds > 0? numFrames/seconds: 0) << " frames/s)" << endl;
+}
+
+
+/**
+ * Populate the PreloadedPDB with a pack file. The coordinates are used
+ * where they are mapped, so loading takes no time regardless of size.
+ *
+ * The pack file must have been written with the same atom selection as is
+ * in effect now. A scratch pack file (see spillPDBFromList()) is mapped
+ * shared, so that coordinates changed by clustering can be paged out to
+ * it instead of taking memory, and it is removed once mapped.
+ */
+void
+PreloadedPDB::loadPackFile(char * filename, bool scratch)
+{
+    // Clustering changes the coordinates (see Clustering::realignDecoys),
+    // so the mapping is copy-on-write, or else writes the scratch file
+    mPack = new MappedFile(filename, true, scratch);
+    if (!mPack->isOpen())
+    {
+        cerr << "Can't open pack file \"" << filename << "\"" << endl;
+        exit(0);
+    }
+    silentfilename = NULL;
+    pdblistfilename = NULL;
+
+    const char * data = mPack->mData;
+    const PackHeader * header = (const PackHeader *) data;
+    if (mPack->mSize < sizeof(PackHeader)
+        || memcmp(header->magic, PACK_MAGIC, sizeof(header->magic)))
+    {
+        cerr << "\"" << filename << "\" is not a pack file" << endl;
+        exit(0);
+    }
+    if (header->byteOrder != PACK_BYTE_ORDER
+        || header->version != PACK_VERSION)
+    {
+        cerr << "Pack file \"" << filename << "\" was written by another "
+             << "version of calibur, or on another kind of machine" << endl;
+        exit(0);
+    }
+    unsigned long long coordsSize = (unsigned long long) header->numDecoys
+                                    * header->numResidues * 3 * sizeof(float);
+    if (header->fileSize != mPack->mSize
+        || header->selectionOffset >= header->namesOffset
+        || header->namesOffset > header->coordsOffset
+        || header->coordsOffset % PACK_ALIGNMENT
+        || header->coordsOffset + coordsSize != header->fileSize
+        || data[header->namesOffset-1] != '\0'
+        || (header->numDecoys
+            && data[header->coordsOffset-1] != '\0'))
+    {
+        cerr << "Pack file \"" << filename << "\" is corrupted" << endl;
+        exit(0);
+    }
+
+    const char * selection = data + header->selectionOffset;
+    if (SimPDB::selection_key() != selection)
+    {
+        cerr << "Pack file \"" << filename << "\" was written with the atom "
+             << "selection" << endl
+             << "    " << selection << endl
+             << "but the current selection is" << endl
+             << "    " << SimPDB::selection_key() << endl;
+        exit(0);
+    }
+
+    mNumDecoy = header->numDecoys;
+    mNumResidue = header->numResidues;
+    mNames = new vector<char *>(0);
+    mNames->reserve(mNumDecoy);
+    const char * name = data + header->namesOffset;
+    const char * namesEnd = data + header->coordsOffset;
+    float * coords = (float *) (data + header->coordsOffset);
+    for (int i=0; i < mNumDecoy; i++)
+    {
+        if (name >= namesEnd)
+        {
+            cerr << "Pack file \"" << filename << "\" is corrupted" << endl;
+            exit(0);
+        }
+        SimPDB * pdb = new SimPDB();
+        pdb->mDecoyID = i;
+        pdb->mProteinFileName = name;
+        pdb->mNumResidue = mNumResidue;
+        pdb->mCAlpha = coords + (size_t) 3*mNumResidue*i;
+        pdb->mOwnsCAlpha = false; // owned by mPack
+        mPDBs.push_back(pdb);
+        mNames->push_back((char *) name);
+        name += strlen(name) + 1;
+    }
+    if (scratch) // nothing is left behind, however we exit
+    {
+        remove(filename);
+        return;
+    }
+    cout << "Mapped " << mNumDecoy << " decoys of " << mNumResidue
+         << " atoms from pack file \"" << filename << "\"" << endl;
+}
+
+
+/**
+ * Write to file, or else remove the partly written file and exit
+ */
+static void
+_write(FILE * file, const void * data, size_t size, char * filename)
+{
+    if (size && fwrite(data, size, 1, file) != 1)
+    {
+        cerr << "Cannot write file \"" << filename << "\"" << endl;
+        fclose(file);
+        remove(filename);
+        exit(0);
+    }
+}
+
+/**
+ * Write what comes before the coordinates in a pack file of the decoys
+ * with the given names
+ */
+static void
+_write_pack_head(FILE * file, const vector<char *>& names, int numResidue,
+                 char * filename)
+{
+    string selection = SimPDB::selection_key();
+    size_t namesSize = 0;
+    for (int i=0; i < names.size(); i++)
+        namesSize += strlen(names[i]) + 1;
+
+    PackHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+    header.version = PACK_VERSION;
+    header.byteOrder = PACK_BYTE_ORDER;
+    header.numDecoys = names.size();
+    header.numResidues = numResidue;
+    header.selectionOffset = sizeof(PackHeader);
+    header.namesOffset = header.selectionOffset + selection.size() + 1;
+    header.coordsOffset = header.namesOffset + namesSize;
+    int padding = (PACK_ALIGNMENT - header.coordsOffset % PACK_ALIGNMENT)
+                  % PACK_ALIGNMENT;
+    header.coordsOffset += padding;
+    header.fileSize = header.coordsOffset + (unsigned long long)
+                      header.numDecoys * numResidue * 3 * sizeof(float);
+
+    _write(file, &header, sizeof(header), filename);
+    _write(file, selection.c_str(), selection.size() + 1, filename);
+    for (int i=0; i < names.size(); i++)
+        _write(file, names[i], strlen(names[i]) + 1, filename);
+    char zeros[PACK_ALIGNMENT] = {0};
+    _write(file, zeros, padding, filename);
+}
+
+/**
+ * Write the loaded decoys into a pack file (see PackHeader), to be loaded
+ * with loadPackFile(). Their coordinates must not have been changed since
+ * they were loaded.
+ */
+void
+PreloadedPDB::writePackFile(char * filename)
+{
+    FILE * file = fopen(filename, "wb");
+    if (!file)
+    {
+        cerr << "Cannot create pack file \"" << filename << "\"" << endl;
+        exit(0);
+    }
+
+    _write_pack_head(file, *mNames, mNumResidue, filename);
+    for (int i=0; i < mPDBs.size(); i++)
+        _write(file, mPDBs[i]->mCAlpha, 3*mNumResidue*sizeof(float), filename);
+    if (fclose(file))
+    {
+        cerr << "Cannot write pack file \"" << filename << "\"" << endl;
+        exit(0);
+    }
+    cout << "Packed " << mPDBs.size() << " decoys of " << mNumResidue
+         << " atoms into \"" << filename << "\"" << endl;
+}
+
+
+/**
+ * Populate the PreloadedPDB with the PDB files specified in a list, for
+ * decoys which are not to be held in memory. Each file is read only once:
+ * the files are read in bulk, in blocks of about SPILL_BLOCK_BYTES of
+ * coordinates, into a scratch file in the format of a pack file, which is
+ * then mapped in their place (see loadPackFile()).
+ *
+ * Returns false, having loaded nothing, if the scratch file cannot be
+ * created.
+ */
+bool
+PreloadedPDB::spillPDBFromList(char * filename)
+{
+    vector<char *> * names = _read_decoy_list(filename);
+    SimPDB * first = _read_first_decoy((*names)[0]);
+    int numResidue = first->mNumResidue;
+
+    char * spillName = DiskAdjacency::scratchFileName(this, "decoys");
+    FILE * file = fopen(spillName, "wb");
+    if (!file)
+    {
+        cerr << "Cannot create scratch file \"" << spillName << "\"" << endl;
+        free(spillName);
+        delete first;
+        return false;
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    _write_pack_head(file, *names, numResidue, spillName);
+    size_t decoyBytes = (size_t) 3*numResidue*sizeof(float);
+    size_t perBlock = SPILL_BLOCK_BYTES / decoyBytes + 1;
+    int numThreads = PreloadedPDB::numThreads();
+    vector<float> block;
+    vector<int> counts;
+    double bytes = 0;
+    bool ioUring = false;
+    for (size_t b=0; b < names->size(); b += perBlock)
+    {
+        size_t end = names->size() - b < perBlock? names->size(): b + perBlock;
+        block.assign((size_t) 3*numResidue*(end - b), 0);
+        counts.assign(end - b, 0);
+        if (b == 0) // already read
+        {
+            memcpy(&block[0], first->mCAlpha, decoyBytes);
+            counts[0] = numResidue;
+            delete first;
+        }
+        BulkReader reader(*names, b == 0? 1: b, end);
+        reader.read([&](size_t i, const char * data, size_t size) {
+            SimPDB pdb;
+            pdb.mProteinFileName = (*names)[i];
+            pdb.mNumResidue = numResidue;
+            pdb.mCAlpha = &block[(size_t) 3*numResidue*(i - b)];
+            pdb.mOwnsCAlpha = false; // owned by block
+            counts[i - b] = pdb.parse(data, size);
+        }, numThreads);
+
+        for (size_t i=b; i < end; i++)
+        {
+            if (counts[i - b] != numResidue)
+            {
+                cout << "Error: \"" << (*names)[i] << "\" "
+                     << "has mismatching number of residues"
+                     << " (should have " << numResidue << " but has "
+                     << counts[i - b] << ")" << endl;
+                fclose(file);
+                remove(spillName); // not to be left behind
+                exit(0);
+            }
+        }
+        _write(file, &block[0], block.size()*sizeof(float), spillName);
+        bytes += reader.mBytes;
+        ioUring = reader.mIoUring;
+    }
+    if (fclose(file))
+    {
+        cerr << "Cannot write scratch file \"" << spillName << "\"" << endl;
+        remove(spillName);
+        exit(0);
+    }
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now()
+                                              - start).count();
+    double mb = bytes / (1024.0*1024.0);
+    cout << "Read " << names->size() << " decoy files once into a scratch"
+         << " file on " << numThreads
+         << (numThreads > 1? " threads": " thread")
+         << (ioUring? " through io_uring": "") << " (" << mb << " MB in "
+         << seconds << " s, " << (seconds > 0? names->size()/seconds: 0)
+         << " files/s, " << (seconds > 0? mb/seconds: 0) << " MB/s)"
+         << endl;
+
+    loadPackFile(spillName, true);
+    pdblistfilename = filename;
+    for (size_t i=0; i < names->size(); i++)
+        delete [] (*names)[i];
+    delete names;
+    free(spillName);
+    return true;
 }
 
 
@@ -388,12 +1823,13 @@ int main()
 
     // Get the names from the loaded PDB for testing
     vector<char *> * mNames = pdbs->mNames;
+    SimPDB::decoyNames = mNames;
 
-    // Get the PDB for each name
+    // Get the PDB for each decoy id
     for (int i=0; i < mNames->size(); i++)
     {
         char * filename = (*mNames)[i];
-        SimPDB * pdb = new SimPDB(filename);
+        SimPDB * pdb = new SimPDB(i);
         cout << filename << ":" << endl;
         for (int j=0; j < pdb->mNumResidue; j++)
             cout << "    " << pdb->mCAlpha[j*3] << ", "
@@ -25,18 +25,57 @@
 #define _PRELOADED_PDB
 
 #include <iostream>
-#include <map>
 #include <vector>
 
 #include "SimpPDB.h"
+#include "MappedFile.h"
 
 using namespace std;
 
 class SimPDB;
+class DecoyStream;
 
-enum INPUT_FILE_TYPE { UNKNOWN=-1, SILENT_FILE, PDB_LIST };
+enum INPUT_FILE_TYPE { UNKNOWN=-1, SILENT_FILE, PDB_LIST, PACK_FILE, PDB_FILE,
+                       TRAJECTORY_FILE, TAR_FILE, DECOY_STREAM };
 INPUT_FILE_TYPE filetype(char * filename);
 unsigned int num_lines_in_file(char * filename);
+int num_residues_in_first_decoy(char * filename);
+
+
+// Least size of the chunks of a silent file read by each thread
+#define MIN_SILENT_CHUNK_BYTES (4*1024*1024)
+// Size of the blocks in which a compressed silent file is decompressed
+#define SILENT_BLOCK_BYTES (1024*1024)
+// Size of the blocks of coordinates in which decoys go into a scratch file
+#define SPILL_BLOCK_BYTES (16*1024*1024)
+
+#define PACK_MAGIC "CALIBUR\x1a"
+#define PACK_VERSION 1
+#define PACK_BYTE_ORDER 0x01020304
+#define PACK_ALIGNMENT 16
+
+/**
+ * Header of a pack file, which holds the selected coordinates of a set of
+ * decoys (see PreloadedPDB::writePackFile). It is followed by
+ * 1. the selection key (SimPDB::selection_key()) the coordinates were
+ *    selected with, NUL-terminated, at selectionOffset,
+ * 2. the decoy names, each NUL-terminated, at namesOffset, and
+ * 3. the centered coordinates, numDecoys*numResidues*3 floats, at
+ *    coordsOffset, which is a multiple of PACK_ALIGNMENT.
+ * Numbers are in the byte order of the machine which wrote the file.
+ */
+struct PackHeader
+{
+    char magic[8];              // PACK_MAGIC
+    unsigned int version;       // PACK_VERSION
+    unsigned int byteOrder;     // PACK_BYTE_ORDER
+    unsigned int numDecoys;
+    unsigned int numResidues;
+    unsigned long long selectionOffset;
+    unsigned long long namesOffset;
+    unsigned long long coordsOffset;
+    unsigned long long fileSize;
+};
 
 
 /**
@@ -49,29 +88,53 @@ unsigned int num_lines_in_file(char * filename);
  * 2. Load it up either with a silent file or with a list of PDB files,
  * 3. Set SimPDB::preloadedPDB to it, and set SimPDB::preloadPDB to true.
  *
- * The use of PreloadedPDB is compulsory for silent files.
+ * Decoys are stored in mPDBs in the order they are loaded, and a decoy's
+ * index in mPDBs is its decoy id. mNames holds the decoy names in the same
+ * order; this is the table SimPDB::decoyNames is set to.
+ *
+ * The SimPDB objects in mPDBs own their coordinates, except those of a
+ * silent file, of models in PDB files, or of a trajectory, which are in a
+ * few large blocks (mStore), and of a pack file (see below). A SimPDB
+ * constructed by id while preloading is on is only a view of these
+ * coordinates (SimPDB::mOwnsCAlpha is false), so the PreloadedPDB must
+ * outlive every such SimPDB. Changes made through a view (e.g. by
+ * Clustering::realignDecoys) are seen by all other views of the same decoy.
+ *
+ * The use of PreloadedPDB is compulsory for silent files, pack files,
+ * trajectories, decoy streams, and models in PDB files (see
+ * SimPDB::multiModel). The decoys of a stream are taken in as they arrive
+ * (see loadStream), and stay owned by mStream.
+ * The coordinates of a pack file are not read but mapped into memory, where
+ * they stay owned by mPack.
  *
  * For a list of decoys, PreloadedPDB is used by default.
- * However, this is bad in some situations. e.g. 36,000 decoys of 100
- * residues each will require about 42M memory. In such situations,
- * using the disk might be better. Hence, PreloadedPDB is off when:
+ * However, this is bad when the decoys do not fit into memory. Hence,
+ * PreloadedPDB is off when:
  * 1. Users override it (by switching off SimPDB::preloadPDB)
- * 2. The number of decoys used is more than ADVISED_THRESHOLD.
+ * 2. The decoys need more than the memory limit (see Clustering::MEM_LIMIT).
  */
 class PreloadedPDB
 {
-public:
-    static unsigned int ADVISED_THRESHOLD;
-
 private:
     char * silentfilename;
     char * pdblistfilename;
+    MappedFile * mPack;      // the mapped pack file, if loaded from one
+    vector<vector<float> > mStore; // coordinates read in blocks
+    DecoyStream * mStream;   // the stream, if loaded from one
+    bool mStreamEnded;       // whether all of its decoys are loaded
 
 public:
+    static int NUM_THREADS;  // for loading decoys. 0 to use all processors
+    static char * topology;  // PDB file for the atoms of a trajectory
+    static char * scoreColumn; // of the SCORE: lines of a silent file
+    static double keepDecoys;  // of lowest score in a silent file, or 0...
+    static bool keepPercent;   // ...in percent of all its decoys, if set
+    static int numThreads();
+
     int mNumResidue;
     int mNumDecoy;
-    vector<char *> * mNames;
-    map<char *, SimPDB *> filename2PDB; // fix this if it is deemed too slow
+    vector<char *> * mNames; // decoy names, indexed by decoy id
+    vector<SimPDB *> mPDBs;  // decoys, indexed by decoy id
 
 
 public:
@@ -79,8 +142,18 @@ public:
     ~PreloadedPDB();
     void loadSilentFile(char * silentfilename);
     void loadPDBFromList(char * pdblistfilename);
-
-    SimPDB * getSimPDB(char * pdbfilename); // unused. for internal testing
+    bool spillPDBFromList(char * pdblistfilename);
+    void loadPDBFile(char * pdbfilename);
+    void loadModels(char * pdbfilename);
+    void loadTrajectory(char * trajectoryfilename);
+    void loadTarFile(char * tarfilename);
+    void loadPackFile(char * packfilename, bool scratch = false);
+    void loadStream(size_t numDecoys);
+    void loadAtoms(PreloadedPDB * from, const vector<int>& atoms);
+    bool streaming() { return mStream && !mStreamEnded; }
+    void writePackFile(char * packfilename);
+
+    SimPDB * getSimPDB(int decoyID) { return mPDBs[decoyID]; }
 };
 
 
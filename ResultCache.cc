@@ -0,0 +1,199 @@
+/*
+ *  **************************************************************************
+ *  Copyright 2026 Shuai Cheng Li and Yen Kaow Ng
+ *  **************************************************************************
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  **************************************************************************
+ * 
+ */
+
+
+
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ResultCache.h"
+#include "Prefetcher.h"
+
+using namespace std;
+
+
+char * ResultCache::directory = NULL;
+
+
+/**
+ * Continue the hash h over size bytes of data (FNV-1a)
+ */
+static unsigned long long
+_hash(unsigned long long h, const void * data, size_t size)
+{
+    const unsigned char * p = (const unsigned char *) data;
+    for (size_t i=0; i < size; i++)
+        h = (h ^ p[i]) * 1099511628211ULL;
+    return h;
+}
+
+#define HASH_START 14695981039346656037ULL
+
+static string
+_hex(unsigned long long h)
+{
+    ostringstream text;
+    text << hex << setw(16) << setfill('0') << h;
+    return text.str();
+}
+
+
+/**
+ * Take the fingerprint of the decoys of the given ids and names. Their
+ * coordinates are read as clustering reads them (see
+ * Clustering::readDecoys), so this is a pass over the decoys unless they
+ * are preloaded.
+ */
+ResultCache::ResultCache(const vector<int>& ids, const vector<char *>& names,
+                         const string& thresholdOptions,
+                         const string& clusterOptions)
+{
+    unsigned long long h = HASH_START;
+    for (size_t i=0; i < names.size(); i++)
+        h = _hash(h, names[i], strlen(names[i]) + 1);
+
+    SimPDB * pdb = new SimPDB(ids[0]);
+    int len = pdb->mNumResidue;
+    Prefetcher prefetcher(vector<int>(ids.begin()+1, ids.end()), len);
+    for (size_t i=0; i < ids.size(); i++)
+    {
+        if (i > 0)
+            pdb = prefetcher.next();
+        h = _hash(h, pdb->mCAlpha, 3*len*sizeof(float));
+        delete pdb;
+    }
+
+    ostringstream decoys;
+    decoys << ids.size() << " decoys of " << len << " atoms " << _hex(h);
+    mDecoys = decoys.str();
+    mThresholdKey = mDecoys + ", " + thresholdOptions;
+    mClustersKey = mDecoys + ", " + clusterOptions;
+    cout << "Decoys fingerprinted as " << mDecoys << endl;
+}
+
+
+/**
+ * The file which the result of key is kept in
+ */
+string
+ResultCache::path(const string& key, const char * suffix)
+{
+    return string(directory) + "/" + _hex(_hash(HASH_START, key.data(),
+                                                 key.size())) + suffix;
+}
+
+/**
+ * Read the result of key into value. Returns false if there is none.
+ */
+bool
+ResultCache::read(const string& key, const char * suffix, string * value)
+{
+    ifstream input(path(key, suffix).c_str(), ios::binary);
+    string magic, written;
+    if (!getline(input, magic) || magic != CACHE_MAGIC
+        || !getline(input, written) || written != key)
+        return false;
+    ostringstream rest;
+    rest << input.rdbuf();
+    *value = rest.str();
+    return true;
+}
+
+/**
+ * Keep value as the result of key. The file is written beside the one it
+ * replaces, so that it is either all there or not at all.
+ */
+void
+ResultCache::write(const string& key, const char * suffix,
+                   const string& value)
+{
+    string filename = path(key, suffix);
+    string temp = filename + ".new";
+    FILE * file = fopen(temp.c_str(), "wb");
+    bool written = file != NULL
+        && fprintf(file, "%s\n%s\n", CACHE_MAGIC, key.c_str()) > 0
+        && (value.empty()
+            || fwrite(value.data(), value.size(), 1, file) == 1);
+    if (file && fclose(file))
+        written = false;
+    if (written)
+    {
+        remove(filename.c_str());
+        written = rename(temp.c_str(), filename.c_str()) == 0;
+    }
+    if (!written)
+    {
+        cout << "WARNING: cannot write \"" << filename << "\" of the cache"
+             << endl;
+        remove(temp.c_str());
+    }
+}
+
+
+/**
+ * Set threshold to the one estimated for the decoys and options. Returns
+ * false if it is not cached.
+ */
+bool
+ResultCache::threshold(float * threshold)
+{
+    string value;
+    if (!read(mThresholdKey, ".threshold", &value))
+        return false;
+    char * end;
+    float t = strtod(value.c_str(), &end);
+    if (end == value.c_str() || t <= 0)
+        return false;
+    *threshold = t;
+    return true;
+}
+
+void
+ResultCache::setThreshold(float threshold)
+{
+    ostringstream value;
+    value << setprecision(9) << threshold << endl;
+    write(mThresholdKey, ".threshold", value.str());
+}
+
+/**
+ * Set clusters to the text that shows the clusters of the decoys found
+ * with the options. Returns false if it is not cached.
+ */
+bool
+ResultCache::clusters(string * clusters)
+{
+    return read(mClustersKey, ".clusters", clusters);
+}
+
+void
+ResultCache::setClusters(const string& clusters)
+{
+    write(mClustersKey, ".clusters", clusters);
+}
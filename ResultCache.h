@@ -0,0 +1,73 @@
+/*
+ *  **************************************************************************
+ *  Copyright 2026 Shuai Cheng Li and Yen Kaow Ng
+ *  **************************************************************************
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  **************************************************************************
+ * 
+ */
+
+
+
+
+#ifndef _RESULT_CACHE_
+#define _RESULT_CACHE_
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+#define CACHE_MAGIC "calibur cache 2"
+
+/**
+ * Results of earlier clusterings, kept in files in a directory (see
+ * --cache) so that a clustering of the same decoys with the same options
+ * takes them instead of computing them again: the threshold estimated,
+ * and the clusters shown (with what is said of the margin between the
+ * largest two).
+ *
+ * The decoys are identified by a fingerprint of their names and of the
+ * coordinates of their selected atoms. Each result is kept in a file named
+ * by a hash of the fingerprint and the options that the result depends on,
+ * which are written out in the file as well. The file holds CACHE_MAGIC,
+ * this key, and then the result, each on lines of its own.
+ */
+class ResultCache
+{
+private:
+    string mDecoys;             // fingerprint of the decoys, as text
+    string mThresholdKey;       // the fingerprint and the options that...
+    string mClustersKey;        // ...the threshold, or the clusters, are of
+
+    string path(const string& key, const char * suffix);
+    bool read(const string& key, const char * suffix, string * value);
+    void write(const string& key, const char * suffix, const string& value);
+
+public:
+    static char * directory;    // where the results are kept, or NULL
+
+    ResultCache(const vector<int>& ids, const vector<char *>& names,
+                const string& thresholdOptions, const string& clusterOptions);
+
+    bool threshold(float * threshold);
+    void setThreshold(float threshold);
+    bool clusters(string * clusters);
+    void setClusters(const string& clusters);
+};
+
+#endif
@@ -29,10 +29,15 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <iomanip>
+#include <algorithm>
+#include <ctype.h>
+#include <mutex>
 
 using namespace std;
 
 #include "SimpPDB.h"
+#include "MappedFile.h"
+#include "Decompressor.h"
 
 
 //- = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = -
@@ -44,12 +49,18 @@ int SimPDB::e_residue = LONGEST_CHAIN;
 char * SimPDB::chains = strdup("AC ");
 vector<string> SimPDB::atom_names = {"CA"};
 vector<string> SimPDB::atom_matchstrs = {" CA ", "CA  ", "  CA", "CA"};
+bool SimPDB::multiModel = false;
+vector<NamedSelection> SimPDB::selections;
+vector<AtomInfo> SimPDB::atomInfo;
 
 
 // Set these two fields to tell SimPDB to use the PreloadedPDB mechanism
 PreloadedPDB * SimPDB::preloadedPDB = NULL;
 bool SimPDB::preloadPDB = true;
 
+// Names of all decoys, indexed by decoy id
+vector<char *> * SimPDB::decoyNames = NULL;
+
 //- = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = -
 
 char aa[23][4] = {"BCK", "GLY", "ALA", "SER", "CYS", "VAL", "THR", "ILE",
@@ -88,6 +99,89 @@ float toFloat(const string& aString)
 }
 
 
+/**
+ * Same as toInt(string), for the field of length len at field, without
+ * copying. The field ends early at a line break.
+ */
+int toInt(const char * field, int len)
+{
+    int i = 0;
+    while (i < len && field[i] == ' ')
+        i++;
+    bool negative = false;
+    if (i < len && (field[i] == '-' || field[i] == '+'))
+        negative = field[i++] == '-';
+    int value = 0;
+    for (; i < len && field[i] != '\n'; i++)
+    {
+        if (field[i] == ' ') // toInt(string) ignores all spaces
+            continue;
+        if (field[i] < '0' || field[i] > '9')
+            break;
+        value = 10*value + (field[i] - '0');
+    }
+    return negative? -value: value;
+}
+
+
+static const double _pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8,
+                                1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+
+/**
+ * Same as toFloat(string), for the field of length len at field, without
+ * copying. Plain decimals such as those in PDB coordinates are converted
+ * directly; anything else is left to atof().
+ */
+float toFloat(const char * field, int len)
+{
+    int i = 0;
+    while (i < len && field[i] == ' ')
+        i++;
+    bool negative = false;
+    if (i < len && (field[i] == '-' || field[i] == '+'))
+        negative = field[i++] == '-';
+
+    // mantissa and exponent are exact for up to 15 digits, so dividing
+    // rounds correctly, as atof() does
+    long long mantissa = 0;
+    int digits = 0;
+    int decimals = 0;
+    bool point = false;
+    for (; i < len && field[i] != ' ' && field[i] != '\n'; i++)
+    {
+        char c = field[i];
+        if (c >= '0' && c <= '9')
+        {
+            mantissa = 10*mantissa + (c - '0');
+            digits++;
+            if (point)
+                decimals++;
+        }
+        else if (c == '.' && !point)
+            point = true;
+        else
+            break;
+    }
+    bool plain = digits > 0 && digits <= 15;
+    for (; plain && i < len && field[i] != '\n'; i++)
+        if (field[i] != ' ' && field[i] != '\r')
+            plain = false;
+    if (plain)
+    {
+        double value = mantissa / _pow10[decimals];
+        return (float) (negative? -value: value);
+    }
+
+    char st[64];
+    int n = 0;
+    for (i=0; i < len && field[i] != '\n' && n < 63; i++)
+        if (field[i] != ' ')
+            st[n++] = field[i];
+    st[n] = '\0';
+    return atof(st);
+}
+
+
 void center_residues(float * mCAlpha, int mNumResidue)
 {
     float cx = 0;
@@ -164,55 +258,55 @@ SimPDB::init_atom_names(string namelist, char delimiter)
 //- = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = -
 // General purpose constructors which handle the preloadedPDB mechanism
 
-SimPDB::SimPDB(char *aFileName)
+SimPDB::SimPDB(int decoyID)
 {
+    mDecoyID = decoyID;
     if (preloadPDB)
     {
-        /*for(int i=0; i<len; i++)
-        {
-          mCAlpha[i]=new float [3]; 
-        }*/
-        SimPDB * pdb = preloadedPDB->filename2PDB[aFileName];
-        mProteinFileName = strdup(pdb->mProteinFileName);
+        // Share the coordinates held by preloadedPDB instead of copying
+        // them. preloadedPDB outlives every SimPDB, so the view stays valid.
+        SimPDB * pdb = preloadedPDB->getSimPDB(decoyID);
+        mProteinFileName = pdb->mProteinFileName;
         mNumResidue = pdb->mNumResidue;
-        mCAlpha = new float[3*mNumResidue];
-        memcpy(mCAlpha, pdb->mCAlpha, 3 * mNumResidue * sizeof(float));
+        mCAlpha = pdb->mCAlpha;
+        mOwnsCAlpha = false;
     }
     else
     {
-        mProteinFileName = aFileName;
+        mProteinFileName = (*decoyNames)[decoyID];
         mNumResidue = LONGEST_CHAIN;
         mCAlpha = new float[3*LONGEST_CHAIN];
+        mOwnsCAlpha = true;
         read();
     }
 }
 
-SimPDB::SimPDB(char *aFileName, int len)
+SimPDB::SimPDB(int decoyID, int len)
 {
+    mDecoyID = decoyID;
     if (preloadPDB)
     {
-        /*for(int i=0; i<len; i++)
-        {
-          mCAlpha[i]=new float [3]; 
-        }*/
-        SimPDB * pdb = preloadedPDB->filename2PDB[aFileName];
-        mProteinFileName = strdup(pdb->mProteinFileName);
+        // Share the coordinates held by preloadedPDB instead of copying
+        // them. preloadedPDB outlives every SimPDB, so the view stays valid.
+        SimPDB * pdb = preloadedPDB->getSimPDB(decoyID);
+        mProteinFileName = pdb->mProteinFileName;
         mNumResidue = pdb->mNumResidue;
-        mCAlpha = new float[3*mNumResidue];
-        memcpy(mCAlpha, pdb->mCAlpha, 3 * mNumResidue * sizeof(float));
+        mCAlpha = pdb->mCAlpha;
+        mOwnsCAlpha = false;
     }
     else
     {
-        mProteinFileName = aFileName;
+        mProteinFileName = (*decoyNames)[decoyID];
         mNumResidue = len;
         mCAlpha = new float[3*len];
+        mOwnsCAlpha = true;
         int count = read();
-        if (count != mNumResidue)
+        if (count != len)
         {
-            cout << "Error: \"" << aFileName
+            cout << "Error: \"" << mProteinFileName
                  << "\" has mismatching number of residues"
-                 << " (should have " << mNumResidue
-                 << " but has only " << count << ")" << endl;
+                 << " (should have " << len
+                 << " but has " << count << ")" << endl;
             exit(0);
         }
     }
@@ -221,135 +315,612 @@ SimPDB::SimPDB(char *aFileName, int len)
 
 SimPDB::~SimPDB() 
 {
-    /* for(int i=0; i<mNumResidue; i++)
-    {
-      delete [] mCAlpha[i];
-    }*/
-    delete [] mCAlpha;
+    if (mOwnsCAlpha) // views into preloadedPDB are not ours to free
+        delete [] mCAlpha;
 }
 
 
 //- = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = -
-// Constructors which DO NOT handle the preloadedPDB mechanism
+// Constructor which DOES NOT handle the preloadedPDB mechanism
 //
-// They should be called from PreloadedPDB only, since it will need to
+// It should be called from PreloadedPDB only, since it will need to
 // bypass the mechanism
 
-SimPDB::SimPDB() {}
-
-SimPDB::SimPDB(int len)
+SimPDB::SimPDB()
 {
-    mNumResidue = len;
-    mCAlpha = new float[3*len];
+    mDecoyID = -1;
+    mCAlpha = NULL;
+    mOwnsCAlpha = true;
 }
 
 
 
 //- = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = -
 
-static bool
-_matches_atom_names(string line)
+/**
+ * The first 4 characters of s packed into a word, and in mask, which of
+ * them s has. Characters past the end of s are taken as NUL.
+ */
+static unsigned int
+_pack4(const char * s, int len, unsigned int * mask)
+{
+    unsigned int word = 0;
+    if (mask)
+        *mask = 0;
+    for (int i=0; i < 4 && i < len; i++)
+    {
+        word |= (unsigned int) (unsigned char) s[i] << (8*i);
+        if (mask)
+            *mask |= 0xffu << (8*i);
+    }
+    return word;
+}
+
+AtomSelection::AtomSelection()
 {
+    for (int b=0; b < 256; b++)
+    {
+        chain[b] = false;
+        for (char * c = SimPDB::chains; *c; c++)
+            if (*c == '*' || toupper(b) == toupper(*c))
+                chain[b] = true;
+    }
     for (int i=0; i < SimPDB::atom_matchstrs.size(); i++)
-        if (line.substr(13, SimPDB::atom_matchstrs[i].size()) ==
-               SimPDB::atom_matchstrs[i])
+    {
+        const string& m = SimPDB::atom_matchstrs[i];
+        unsigned int mask;
+        unsigned int word = _pack4(m.c_str(), m.size(), &mask);
+        matchWords.push_back(word);
+        matchMasks.push_back(mask);
+    }
+    allChains = strchr(SimPDB::chains, '*') != NULL;
+    names = SimPDB::atom_names;
+    s_residue = SimPDB::s_residue;
+    e_residue = SimPDB::e_residue;
+    onePerResidue = SimPDB::atom_names.size() == 1;
+    keepSegments = !SimPDB::selections.empty();
+}
+
+/**
+ * Whether word, the 4 characters from column 13 of an ATOM record, starts
+ * with any of the atom_matchstrs
+ */
+bool
+AtomSelection::matches(unsigned int word)
+{
+    for (int i=0; i < matchWords.size(); i++)
+        if ((word & matchMasks[i]) == matchWords[i])
             return true;
     return false;
 }
 
 /**
- * Reads a PDB file from disk. Do not read from PDB files anywhere else.
+ * Whether name (an atom name of an mmCIF file) is one of the atom_names
  */
-int
-SimPDB::read()
+bool
+AtomSelection::matchesName(const char * name, int len)
+{
+    for (int i=0; i < names.size(); i++)
+        if (names[i].size() == len && !memcmp(names[i].c_str(), name, len))
+            return true;
+    return false;
+}
+
+/**
+ * The selection is compiled when the first decoy is read, so the settings
+ * above must not change after that.
+ */
+AtomSelection *
+SimPDB::selection()
 {
-    ifstream input(mProteinFileName);
-    if (!input)
+    static AtomSelection * compiled = NULL;
+    if (compiled == NULL)
+        compiled = new AtomSelection();
+    return compiled;
+}
+
+
+/**
+ * Keep info as the AtomInfo of the loaded atoms, unless that of another
+ * decoy is already kept. Called by the threads which parse decoys.
+ */
+void
+SimPDB::record_atoms(const vector<AtomInfo>& info)
+{
+    static mutex lock;
+    lock_guard<mutex> guard(lock);
+    if (atomInfo.empty())
+        atomInfo = info;
+}
+
+/**
+ * The indices into loaded of the atoms of this selection, which are those
+ * a decoy would be read with, had it been read with this selection alone:
+ * atoms of the chains and range, up to the TER record after the first.
+ */
+vector<int>
+NamedSelection::atoms(const vector<AtomInfo>& loaded)
+{
+    bool allChains = strchr(chains, '*') != NULL;
+    vector<int> atoms;
+    int segment = -1;
+    for (int i=0; i < loaded.size(); i++)
     {
-        cerr << "Cannot find protein file " << mProteinFileName << endl;
-        exit(0);
+        const AtomInfo& a = loaded[i];
+        bool chain = allChains || a.chain == '*';
+        for (char * c = chains; !chain && a.chain && *c; c++)
+            chain = toupper(a.chain) == toupper(*c);
+        if (!chain || a.number < s_residue)
+            continue;
+        if (a.number > e_residue)
+            break;
+        if (segment < 0)
+            segment = a.segment;
+        else if (a.segment != segment)
+            break;
+        atoms.push_back(i);
     }
-    cout.flush();
-    char buf[400];
-    mNumResidue = 0;
-    float x, y, z;
-    char c = 'a';
+    return atoms;
+}
+
+/**
+ * The selection as the options which specify it, e.g. -r 1,4000 -c "AC "
+ * -a CA. Files derived from the selected atoms record this, so that they
+ * are not used with another selection.
+ */
+string
+SimPDB::selection_key()
+{
+    ostringstream key;
+    key << "-r " << s_residue << "," << e_residue
+        << " -c \"" << chains << "\" -a ";
+    for (int i=0; i < atom_names.size(); i++)
+        key << (i? ",": "") << atom_names[i];
+    return key.str();
+}
+
+
+/**
+ * Parses one PDB model in buf (of length size), storing the coordinates of
+ * the selected atoms in coords, which has room for maxAtoms atoms. The
+ * columns are read in place, so there is no copying or allocation.
+ *
+ * Returns the number of selected atoms, which may exceed maxAtoms (those
+ * past maxAtoms are not stored). If used is given, it is set to the number
+ * of bytes up to where parsing stopped, i.e. to the start of the next model
+ * if there is one. If atoms is given (with room for maxAtoms), it is set to
+ * the index of each selected atom among all the ATOM and HETATM records,
+ * which is where the atom is in a trajectory of the model.
+ */
+int
+parse_pdb(const char * buf, size_t size, float * coords, int maxAtoms,
+          size_t * used, int * atoms)
+{
+    AtomSelection * sel = SimPDB::selection();
+    const char * p = buf;
+    const char * end = buf + size;
     bool read = false;
-    
     int prevID = -10000;
     int count = 0;
-    
     int CA_number = 1;
+    int atom = -1; // index of the current ATOM or HETATM record
+    int segment = 0; // TER records passed, if sel->keepSegments
+    vector<AtomInfo> info;
 
-    //float cx = 0;
-    //float cy = 0;
-    //float cz = 0;
-    int count3 = 0; 
-    //mSquaredSum=0;   
-    for (int rcount=0; !input.eof(); rcount++)
+    for (int rcount=0; p < end; rcount++)
     {
         if (rcount > 10000 && count == 0) // this ain't no PDB file bruh
             break;
-        input.getline(buf, 400);
-        string line=buf;
-        if (line.substr(0, 3) == "TER" && read == true) break;
-        if (line.substr(0, 6) == "ENDMDL") break;
+        const char * line = p;
+        const char * eol = (const char *) memchr(p, '\n', end - p);
+        if (eol == NULL)
+            eol = end;
+        p = eol < end? eol+1: end;
+        int len = eol - line;
+
+        if (len >= 3 && !strncmp(line, "TER", 3))
+        {
+            if (sel->keepSegments)
+                segment++;
+            else if (read == true)
+                break;
+        }
+        if (len >= 6 && !strncmp(line, "ENDMDL", 6)) break;
+
+        if (!(len >= 4 && !strncmp(line, "ATOM", 4))
+            && !(len >= 6 && !strncmp(line, "HETATM", 6)))
+            continue;
+        atom++;
+
+        if (len <= 13 || !sel->matches(_pack4(line+13, len-13, NULL)))
+            continue;
+
+        // At this point an atom in PDB::atom_names has been discovered
+        // We want to further filter it based on the following two
+        // criteria: chain and region.
+
+        // Check if the chain which this atom belongs to is to be included
+        if (!sel->chain[(unsigned char) (len > 21? line[21]: ' ')])
+        {
+            CA_number++;
+            continue;
+        }
+
+        // Check if the CA atom is within the region to analyze
+        if (CA_number < sel->s_residue)
+        {
+            CA_number++;
+            continue;
+        }
+        else if (CA_number > sel->e_residue)
+            break;
 
-        if (line.substr(0, 4) != "ATOM" && line.substr(0, 6) != "HETATM")
+        read = true;
+        int residueID = len > 22? toInt(line+22, min(6, len-22)): 0;
+        if (sel->onePerResidue && residueID == prevID)
             continue;
 
-        if (_matches_atom_names(line))
+        prevID = residueID;
+        if (count < maxAtoms)
         {
-            // At this point an atom in PDB::atom_names has been discovered
-            // We want to further filter it based on the following two
-            // criteria: chain and region.
-           
-            // Check if the chain which this atom belongs to is to be included
-            bool include_chain = false;
-            for (char * c = SimPDB::chains; *c; c++)
-                if (*c == '*' || toupper(line[21]) == toupper(*c))
-                {
-                    include_chain = true;
-                    break;
-                }
-            if (!include_chain)
+            float * c = coords + 3*count;
+            c[0] = len > 30? toFloat(line+30, min(8, len-30)): 0;
+            c[1] = len > 38? toFloat(line+38, min(8, len-38)): 0;
+            c[2] = len > 46? toFloat(line+46, min(8, len-46)): 0;
+            if (atoms)
+                atoms[count] = atom;
+            if (sel->keepSegments)
             {
-                CA_number++;
-                continue;
+                AtomInfo a = { len > 21? line[21]: ' ', CA_number, segment };
+                info.push_back(a);
             }
+        }
+        count++;
 
-            // Check if the CA atom is within the region to analyze
-            if (CA_number < SimPDB::s_residue)
+        CA_number++;
+    }
+    if (sel->keepSegments)
+        SimPDB::record_atoms(info);
+
+    if (used)
+        *used = p - buf;
+    return count;
+}
+
+
+//- = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = -
+// mmCIF
+//- = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = -
+
+/**
+ * White space in mmCIF files, by character
+ */
+struct CifSpaceTable
+{
+    bool space[256];
+
+    CifSpaceTable()
+    {
+        memset(space, 0, sizeof(space));
+        space[(unsigned char) ' '] = space[(unsigned char) '\t'] = true;
+        space[(unsigned char) '\n'] = space[(unsigned char) '\r'] = true;
+    }
+};
+static const CifSpaceTable _cif_spaces;
+
+static inline bool
+_cif_space(char c)
+{
+    return _cif_spaces.space[(unsigned char) c];
+}
+
+/**
+ * The token at p of an mmCIF file (which starts at buf), after which p is
+ * moved past it. Tokens are separated by white space, and comments are
+ * skipped. A quoted token ('...' or "...", closed by a quote followed by
+ * white space) or a text field (the lines between two lines that start
+ * with ';') is given without its delimiters, and quoted is set.
+ * Returns false at the end.
+ */
+static inline bool
+_cif_token(const char * buf, const char *& p, const char * end,
+           const char *& token, int& len, bool& quoted)
+{
+    for (;;)
+    {
+        while (p < end && _cif_space(*p))
+            p++;
+        if (p == end)
+            return false;
+        if (*p != '#')
+            break;
+        p = (const char *) memchr(p, '\n', end - p);
+        if (p == NULL)
+            p = end;
+    }
+
+    quoted = *p == '\'' || *p == '"'
+             || (*p == ';' && (p == buf || p[-1] == '\n'));
+    if (!quoted)
+    {
+        token = p;
+        while (p < end && !_cif_space(*p))
+            p++;
+        len = p - token;
+    }
+    else if (*p == ';')
+    {
+        token = p+1;
+        const char * q = token;
+        while ((q = (const char *) memchr(q, '\n', end - q)) != NULL
+               && (q+1 == end || q[1] != ';'))
+            q++;
+        len = (q? q: end) - token;
+        p = q? q+2: end;
+    }
+    else
+    {
+        char quote = *p;
+        token = p+1;
+        const char * q = token;
+        while (q < end && !(*q == quote && (q+1 == end || _cif_space(q[1]))))
+            q++;
+        len = q - token;
+        p = q < end? q+1: end;
+    }
+    return true;
+}
+
+/**
+ * Whether a token starts with word (in lower case), ignoring case, as the
+ * reserved words of mmCIF are
+ */
+static inline bool
+_cif_starts(const char * token, int len, const char * word)
+{
+    int i;
+    for (i=0; word[i]; i++)
+        if (i == len || tolower((unsigned char) token[i]) != word[i])
+            return false;
+    return true;
+}
+
+/**
+ * Whether an (unquoted) token is a tag or a reserved word, which ends the
+ * values of a loop
+ */
+static inline bool
+_cif_keyword(const char * token, int len)
+{
+    return token[0] == '_' || _cif_starts(token, len, "loop_")
+           || _cif_starts(token, len, "data_")
+           || _cif_starts(token, len, "save_")
+           || _cif_starts(token, len, "stop_")
+           || _cif_starts(token, len, "global_");
+}
+
+/**
+ * Whether buf (of length size) is an mmCIF file, which begins with a
+ * data_ block
+ */
+bool
+is_cif(const char * buf, size_t size)
+{
+    const char * p = buf;
+    const char * token;
+    int len;
+    bool quoted;
+    return _cif_token(buf, p, buf + size, token, len, quoted) && !quoted
+           && len >= 5 && !strncmp(token, "data_", 5);
+}
+
+/**
+ * Parses the first model in the _atom_site loop of an mmCIF file, as
+ * parse_pdb() does a PDB file. The columns of the loop are found once, from
+ * its header, and each row is split into tokens in place.
+ *
+ * The auth_ columns (atom name, chain and residue number) are used where
+ * there are, as they are what a PDB file has, and the label_ columns
+ * otherwise. A chain of unknown id ('.' or '?') is taken as ' '.
+ */
+int
+parse_cif(const char * buf, size_t size, float * coords, int maxAtoms,
+          size_t * used, int * atoms)
+{
+    enum { ATOM_ID, ASYM_ID, SEQ_ID, LABEL_ATOM_ID, LABEL_ASYM_ID,
+           LABEL_SEQ_ID, X, Y, Z, MODEL, NUM_FIELDS };
+    const char * tags[NUM_FIELDS] = {
+        "auth_atom_id", "auth_asym_id", "auth_seq_id", "label_atom_id",
+        "label_asym_id", "label_seq_id", "Cartn_x", "Cartn_y", "Cartn_z",
+        "pdbx_PDB_model_num" };
+
+    AtomSelection * sel = SimPDB::selection();
+    const char * p = buf;
+    const char * end = buf + size;
+    const char * token;
+    int len;
+    bool quoted;
+
+    // Find the loop of _atom_site, and its columns
+    int column[NUM_FIELDS];
+    int numColumns = 0;
+    while (numColumns == 0 && _cif_token(buf, p, end, token, len, quoted))
+    {
+        if (quoted || len != 5 || !_cif_starts(token, len, "loop_"))
+            continue;
+        for (int f=0; f < NUM_FIELDS; f++)
+            column[f] = -1;
+        const char * q = p;
+        while (_cif_token(buf, q, end, token, len, quoted) && !quoted
+               && len > 11 && !strncmp(token, "_atom_site.", 11))
+        {
+            for (int f=0; f < NUM_FIELDS; f++)
+                if (len - 11 == strlen(tags[f])
+                    && !strncmp(token + 11, tags[f], len - 11))
+                    column[f] = numColumns;
+            numColumns++;
+            p = q;
+        }
+    }
+    for (int f=ATOM_ID; f <= SEQ_ID; f++)
+        if (column[f] < 0)
+            column[f] = column[f + LABEL_ATOM_ID];
+    if (numColumns == 0 || column[ATOM_ID] < 0 || column[X] < 0
+        || column[Y] < 0 || column[Z] < 0)
+    {
+        if (used)
+            *used = size;
+        return 0;
+    }
+
+    vector<const char *> field(numColumns);
+    vector<int> fieldLen(numColumns);
+    const char * model = NULL; // of the first row
+    int modelLen = 0;
+    int prevID = -10000;
+    int count = 0;
+    int CA_number = 1;
+    vector<AtomInfo> info;
+    for (int atom=0; ; atom++)
+    {
+        const char * row = p;
+        int n;
+        for (n=0; n < numColumns; n++)
+        {
+            if (!_cif_token(buf, p, end, token, len, quoted)
+                || (n == 0 && !quoted && _cif_keyword(token, len)))
+                break;
+            field[n] = token;
+            fieldLen[n] = len;
+        }
+        if (n < numColumns) // the end of the loop
+        {
+            p = row;
+            break;
+        }
+
+        if (column[MODEL] >= 0)
+        {
+            const char * m = field[column[MODEL]];
+            int mLen = fieldLen[column[MODEL]];
+            if (model == NULL)
             {
-                CA_number++;
-                continue;
+                model = m;
+                modelLen = mLen;
             }
-            else if (CA_number > SimPDB::e_residue)
+            else if (mLen != modelLen || strncmp(m, model, mLen))
+            {
+                p = row;
                 break;
+            }
+        }
 
-            read = true;
-            int residueID = toInt(line.substr(22, 6));
-            if (SimPDB::atom_names.size() == 1 && residueID == prevID)
-                continue;
+        if (!sel->matchesName(field[column[ATOM_ID]],
+                              fieldLen[column[ATOM_ID]]))
+            continue;
 
-            prevID = residueID; 
-            x = toFloat(line.substr(30, 8));
-            y = toFloat(line.substr(38, 8));
-            z = toFloat(line.substr(46, 8));
-            string AAType = line.substr();
-            count3 = 3*count;   
-            mCAlpha[count3]   = x; 
-            mCAlpha[count3+1] = y; 
-            mCAlpha[count3+2] = z;
-            //mSquaredSum+=x*x+y*y+z*z;
-            count++;
+        // Check if the chain which this atom belongs to is to be included
+        if (!sel->allChains && column[ASYM_ID] >= 0)
+        {
+            const char * chain = field[column[ASYM_ID]];
+            int chainLen = fieldLen[column[ASYM_ID]];
+            unsigned char c = chainLen != 1 || *chain == '.' || *chain == '?'?
+                              ' ': *chain;
+            if (chainLen > 1 || !sel->chain[c])
+            {
+                CA_number++;
+                continue;
+            }
+        }
 
+        // Check if the atom is within the region to analyze
+        if (CA_number < sel->s_residue)
+        {
             CA_number++;
+            continue;
+        }
+        else if (CA_number > sel->e_residue)
+            break;
+
+        int residueID = column[SEQ_ID] >= 0?
+                        toInt(field[column[SEQ_ID]], fieldLen[column[SEQ_ID]]):
+                        0;
+        if (sel->onePerResidue && residueID == prevID)
+            continue;
+
+        prevID = residueID;
+        if (count < maxAtoms)
+        {
+            float * c = coords + 3*count;
+            c[0] = toFloat(field[column[X]], fieldLen[column[X]]);
+            c[1] = toFloat(field[column[Y]], fieldLen[column[Y]]);
+            c[2] = toFloat(field[column[Z]], fieldLen[column[Z]]);
+            if (atoms)
+                atoms[count] = atom;
+            if (sel->keepSegments)
+            {
+                AtomInfo a = { '*', CA_number, 0 };
+                if (column[ASYM_ID] >= 0)
+                {
+                    const char * chain = field[column[ASYM_ID]];
+                    int chainLen = fieldLen[column[ASYM_ID]];
+                    a.chain = chainLen > 1? '\0':
+                              *chain == '.' || *chain == '?'? ' ': *chain;
+                }
+                info.push_back(a);
+            }
         }
-    }//while
+        count++;
+
+        CA_number++;
+    }
+    if (sel->keepSegments)
+        SimPDB::record_atoms(info);
 
-    mNumResidue = count;
-    input.close();
+    if (used)
+        *used = p - buf;
+    return count;
+}
+
+/**
+ * Reads a PDB file, which may be compressed, from disk. Do not read from
+ * PDB files anywhere else.
+ * mCAlpha must have room for mNumResidue atoms.
+ *
+ * Returns the number of selected atoms in the file, even if there is more
+ * than room for them.
+ */
+int
+SimPDB::read()
+{
+    MappedFile input(mProteinFileName);
+    if (!input.isOpen())
+    {
+        cerr << "Cannot find protein file " << mProteinFileName << endl;
+        exit(0);
+    }
+    return parse(input.mData, input.mSize);
+}
+
+/**
+ * Read the selected atoms from the contents of a decoy file, which may be
+ * compressed. Returns the number of atoms found, as read() does.
+ */
+int
+SimPDB::parse(const char * data, size_t size)
+{
+    vector<char> text;
+    if (compression(data, size) != NOT_COMPRESSED)
+    {
+        Decompressor(data, size, mProteinFileName).readAll(text);
+        data = text.empty()? "": &text[0];
+        size = text.size();
+    }
+    int count = is_cif(data, size)?
+                parse_cif(data, size, mCAlpha, mNumResidue, NULL):
+                parse_pdb(data, size, mCAlpha, mNumResidue, NULL);
+    if (count < mNumResidue)
+        mNumResidue = count;
 
     center_residues(mCAlpha, mNumResidue);
     return count;
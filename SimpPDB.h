@@ -26,6 +26,9 @@
 
 #define LONGEST_CHAIN 4000
 #include <iostream>
+#include <vector>
+#include <string>
+#include <stddef.h>
 
 #include "PreloadedPDB.h"
 
@@ -34,24 +37,97 @@ using namespace std;
 
 int toInt(const string&);
 float toFloat(const string&);
+int toInt(const char *, int);
+float toFloat(const char *, int);
 void center_residues(float *, int);
+int parse_pdb(const char *, size_t, float *, int, size_t *, int * = NULL);
+bool is_cif(const char *, size_t);
+int parse_cif(const char *, size_t, float *, int, size_t *, int * = NULL);
 
 
 class PreloadedPDB;
 
+
+/**
+ * The atom selection of SimPDB (chains, atom names and residue range),
+ * compiled into tables for parse_pdb() and parse_cif()
+ */
+struct AtomSelection
+{
+    bool chain[256];          // whether to include atoms of each chain id
+    bool allChains;           // including those with longer ids (mmCIF)
+    vector<unsigned int> matchWords; // atom_matchstrs, 4 characters packed
+    vector<unsigned int> matchMasks; // which characters of the word count
+    vector<string> names;     // atom_names, for mmCIF
+    int s_residue;
+    int e_residue;
+    bool onePerResidue;       // only one atom name is selected
+    bool keepSegments;        // read past TER records (see SimPDB::selections)
+
+    AtomSelection();          // compiles the current SimPDB settings
+    bool matches(unsigned int word);
+    bool matchesName(const char * name, int len);
+};
+
+/**
+ * Where a loaded atom is in its decoy: its chain, its number as -r counts
+ * the atoms, and the number of TER records before it. '\0' stands for a
+ * chain id of more than one character (mmCIF), and '*' for no chain id.
+ */
+struct AtomInfo
+{
+    char chain;
+    int number;
+    int segment;
+};
+
+/**
+ * One of a number of atom selections which are clustered in turn, each
+ * by a residue range and chains as -r and -c give them
+ */
+struct NamedSelection
+{
+    char * name;
+    int s_residue;
+    int e_residue;
+    char * chains;
+    vector<int> atoms(const vector<AtomInfo>& loaded);
+};
+
 class SimPDB
 {
     public:
       /**
        * These parameters control how PDB files are to be loaded.
-       * They do not apply to silent file, which are assumed to be
-       * pre-processed.
+       * They do not apply to text silent file, which are assumed to be
+       * pre-processed. In binary silent files, atoms are selected by
+       * their position in the residue, so only N, CA, C and O can be.
        */
       static int s_residue;
       static int e_residue;
       static char * chains;
       static vector<string> atom_names;
       static vector<string> atom_matchstrs;
+      static AtomSelection * selection(); // the above, compiled
+      static string selection_key();      // the above, as text
+
+      /**
+       * Selections to cluster in turn. If there are any, the decoys are
+       * loaded once, with the union of their residue ranges and chains
+       * (and without stopping at a TER record), and the AtomInfo of the
+       * atoms of the first decoy parsed is kept in atomInfo. Each selection
+       * picks its atoms from these.
+       */
+      static vector<NamedSelection> selections;
+      static vector<AtomInfo> atomInfo;
+      static void record_atoms(const vector<AtomInfo>& info);
+
+      /**
+       * Whether each PDB file in a list holds a number of models (an
+       * ensemble), each of which is a decoy named file#model. The models
+       * are always preloaded.
+       */
+      static bool multiModel;
 
       /**
        * This feature allows the preloading of SimPDB objects.
@@ -60,22 +136,31 @@ class SimPDB
       static PreloadedPDB * preloadedPDB;
       static bool preloadPDB;
 
+      /**
+       * Decoys are identified by their index into decoyNames, a table set
+       * up once when the decoys are listed (see Clustering::readDecoyNames).
+       * The names are only used for reading from disk and for output.
+       */
+      static vector<char *> * decoyNames;
+
     public:
+      int mDecoyID;
       const char* mProteinFileName;
       int mNumResidue;
       //double mSquaredSum;
       float * mCAlpha;
+      bool mOwnsCAlpha; // false if mCAlpha is a view into preloadedPDB
       int read();
+      int parse(const char * data, size_t size); // of a file read by caller
       static int init_atom_names(string namelist, char delimiter);
 
     public:
-      SimPDB(char* aProteinFileName);
-      SimPDB(char* aProteinFileName, int len);
+      SimPDB(int decoyID);
+      SimPDB(int decoyID, int len);
       ~SimPDB();
 
-      // Special constructors used only by PreloadedPDB. Don't touch.
+      // Special constructor used only by PreloadedPDB. Don't touch.
       SimPDB();
-      SimPDB(int len);
 };
 
 #endif
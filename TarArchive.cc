@@ -0,0 +1,217 @@
+/*
+ *  **************************************************************************
+ *  Copyright 2026 Shuai Cheng Li and Yen Kaow Ng
+ *  **************************************************************************
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  **************************************************************************
+ * 
+ */
+
+
+
+#include <iostream>
+#include <string.h>
+#include <stdlib.h>
+
+#include "TarArchive.h"
+
+
+/**
+ * The number in a numeric field of a header: octal digits, possibly
+ * between spaces and NULs, or (GNU) base-256 if the first byte has its
+ * high bit set. An empty field is 0. Returns false if the field is not a
+ * number.
+ */
+static bool
+_tar_number(const char * field, int width, unsigned long long& value)
+{
+    const unsigned char * p = (const unsigned char *) field;
+    value = 0;
+    if (p[0] & 0x80)
+    {
+        if (p[0] & 0x40) // negative
+            return false;
+        value = p[0] & 0x3f;
+        for (int i=1; i < width; i++)
+        {
+            if (value >> 56)
+                return false;
+            value = (value << 8) | p[i];
+        }
+        return true;
+    }
+    int i = 0;
+    while (i < width && p[i] == ' ')
+        i++;
+    for (; i < width && p[i] >= '0' && p[i] <= '7'; i++)
+        value = value*8 + (p[i] - '0');
+    for (; i < width; i++)
+        if (p[i] != ' ' && p[i] != 0)
+            return false;
+    return true;
+}
+
+
+/**
+ * Whether the checksum of a header is right. The checksum is the sum of
+ * the bytes of the header, with those of the checksum taken as spaces;
+ * some old archivers summed them as signed chars.
+ */
+static bool
+_tar_checksum_ok(const char * header)
+{
+    unsigned long long stored;
+    if (!_tar_number(header + 148, 8, stored))
+        return false;
+    unsigned long long sum = 0;
+    long long signedSum = 0;
+    for (int i=0; i < TAR_BLOCK; i++)
+    {
+        char c = (i >= 148 && i < 156)? ' ': header[i];
+        sum += (unsigned char) c;
+        signedSum += (signed char) c;
+    }
+    return stored == sum || (long long) stored == signedSum;
+}
+
+
+static bool
+_is_zero_block(const char * block)
+{
+    for (int i=0; i < TAR_BLOCK; i++)
+        if (block[i])
+            return false;
+    return true;
+}
+
+
+bool
+is_tar(const char * data, size_t size)
+{
+    return size >= TAR_BLOCK && !_is_zero_block(data)
+           && _tar_checksum_ok(data);
+}
+
+
+static void
+_corrupted(const char * filename)
+{
+    cerr << "Corrupted tar archive \"" << filename << "\"" << endl;
+    exit(0);
+}
+
+
+/**
+ * Read the path and size records from the body of a pax header, of which
+ * each record is "length key=value\n"
+ */
+static void
+_read_pax(const char * p, size_t size, const char * filename, string& path,
+          unsigned long long& paxSize, bool& hasPaxSize)
+{
+    const char * end = p + size;
+    while (p < end && *p)
+    {
+        size_t len = 0;
+        const char * q = p;
+        while (q < end && *q >= '0' && *q <= '9' && len <= size)
+            len = len*10 + (*q++ - '0');
+        if (q == p || q == end || *q != ' ' || len > (size_t) (end - p)
+            || len < (size_t) (q - p) + 2 || p[len-1] != '\n')
+            _corrupted(filename);
+        const char * key = q+1;
+        const char * eq = (const char *) memchr(key, '=', p + len-1 - key);
+        if (!eq)
+            _corrupted(filename);
+        string value(eq+1, p + len-1);
+        if (eq - key == 4 && !strncmp(key, "path", 4))
+            path = value;
+        else if (eq - key == 4 && !strncmp(key, "size", 4))
+        {
+            paxSize = strtoull(value.c_str(), NULL, 10);
+            hasPaxSize = true;
+        }
+        p += len;
+    }
+}
+
+
+void
+read_tar(const char * data, size_t size, const char * filename,
+         vector<TarMember>& members)
+{
+    string longName;          // of the next member (GNU or pax)
+    unsigned long long paxSize = 0;
+    bool hasPaxSize = false;  // the next member's size is paxSize
+    size_t offset = 0;
+    while (offset + TAR_BLOCK <= size)
+    {
+        const char * header = data + offset;
+        if (_is_zero_block(header)) // the end of the archive
+            break;
+        unsigned long long memberSize;
+        if (!_tar_checksum_ok(header)
+            || !_tar_number(header + 124, 12, memberSize))
+            _corrupted(filename);
+        char type = header[156];
+        if (hasPaxSize && type != 'x' && type != 'g')
+            memberSize = paxSize;
+        offset += TAR_BLOCK;
+        if (memberSize > size - offset)
+        {
+            cerr << "Tar archive \"" << filename << "\" ends in the middle"
+                 << " of a member" << endl;
+            exit(0);
+        }
+        const char * body = data + offset;
+        offset += (memberSize + TAR_BLOCK-1) / TAR_BLOCK * TAR_BLOCK;
+
+        if (type == 'L') // GNU long name of the next member
+        {
+            longName.assign(body, strnlen(body, memberSize));
+            continue;
+        }
+        if (type == 'x') // pax header of the next member
+        {
+            _read_pax(body, memberSize, filename, longName, paxSize,
+                      hasPaxSize);
+            continue;
+        }
+        if (type == 'g') // pax header of the archive
+            continue;
+
+        TarMember member;
+        member.name = longName;
+        if (member.name.empty())
+        {
+            member.name.assign(header, strnlen(header, 100));
+            // POSIX ustar splits long names; GNU uses the prefix otherwise
+            const char * prefix = header + 345;
+            if (!memcmp(header + 257, "ustar\0", 6) && prefix[0])
+                member.name = string(prefix, strnlen(prefix, 155)) + "/"
+                              + member.name;
+        }
+        member.data = body;
+        member.size = memberSize;
+        longName.clear();
+        hasPaxSize = false;
+
+        bool regular = type == '0' || type == '\0' || type == '7';
+        if (regular && !member.name.empty()
+            && member.name[member.name.size()-1] != '/') // not a directory
+            members.push_back(member);
+    }
+}
@@ -0,0 +1,64 @@
+/*
+ *  **************************************************************************
+ *  Copyright 2026 Shuai Cheng Li and Yen Kaow Ng
+ *  **************************************************************************
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  **************************************************************************
+ * 
+ */
+
+
+
+#ifndef _TAR_ARCHIVE_
+#define _TAR_ARCHIVE_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+#define TAR_BLOCK 512
+
+// Whether data begins with a tar header (of which the checksum is right)
+bool is_tar(const char * data, size_t size);
+
+
+/**
+ * A regular file in a tar archive, as a view into the archive
+ */
+struct TarMember
+{
+    string name;        // path in the archive
+    const char * data;
+    size_t size;
+};
+
+
+/**
+ * Index the regular files of a tar archive held in memory, in one pass
+ * over the headers. ustar (with its name prefix), GNU (long names, and
+ * base-256 sizes) and pax (path and size) headers are understood; links,
+ * directories and other special members are skipped.
+ *
+ * Errors, such as an archive that ends in the middle of a member, end the
+ * program with a message naming the file.
+ */
+void read_tar(const char * data, size_t size, const char * filename,
+              vector<TarMember>& members);
+
+#endif
@@ -0,0 +1,549 @@
+/*
+ *  **************************************************************************
+ *  Copyright 2026 Shuai Cheng Li and Yen Kaow Ng
+ *  **************************************************************************
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  **************************************************************************
+ * 
+ */
+
+
+
+
+#include <iostream>
+#include <algorithm>
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "Trajectory.h"
+
+using namespace std;
+
+
+#define DCD_HEADER_BYTES 84
+#define XTC_MAGIC 1995
+#define XTC_HEADER_BYTES 56 // magic, #atoms, step, time, box, #atoms again
+
+
+static unsigned int
+_swap(unsigned int x)
+{
+    return (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000)
+           | (x << 24);
+}
+
+// A big-endian (XDR) int
+static int
+_xdr_int(const char * p)
+{
+    const unsigned char * u = (const unsigned char *) p;
+    return (int) ((unsigned int) u[0] << 24 | u[1] << 16 | u[2] << 8 | u[3]);
+}
+
+// A big-endian (XDR) float
+static float
+_xdr_float(const char * p)
+{
+    int i = _xdr_int(p);
+    float f;
+    memcpy(&f, &i, sizeof(f));
+    return f;
+}
+
+
+TRAJECTORY_FORMAT
+trajectory_format(const char * data, size_t size)
+{
+    if (size >= 8 && !strncmp(data+4, "CORD", 4))
+    {
+        unsigned int marker;
+        memcpy(&marker, data, sizeof(marker));
+        if (marker == DCD_HEADER_BYTES || _swap(marker) == DCD_HEADER_BYTES)
+            return DCD;
+    }
+    if (size >= 4 && _xdr_int(data) == XTC_MAGIC)
+        return XTC;
+    return NOT_TRAJECTORY;
+}
+
+
+Trajectory::Trajectory(const char * filename)
+    : mFile(filename)
+{
+    mFileName = filename;
+    if (!mFile.isOpen())
+    {
+        cerr << "Cannot find trajectory file \"" << filename << "\"" << endl;
+        exit(0);
+    }
+    mFormat = trajectory_format(mFile.mData, mFile.mSize);
+    mPos = mFile.mData;
+    mEnd = mFile.mData + mFile.mSize;
+    mNumFrames = 0;
+    mSwap = mHasCell = mHas4D = false;
+
+    switch (mFormat)
+    {
+    case DCD:
+        readDCDHeader();
+        break;
+    case XTC:
+        if (mEnd - mPos < XTC_HEADER_BYTES)
+            corrupted();
+        mNumAtoms = _xdr_int(mPos + 4);
+        if (mNumAtoms <= 0)
+            corrupted();
+        break;
+    default:
+        cerr << "\"" << filename << "\" is not a DCD or XTC trajectory"
+             << endl;
+        exit(0);
+    }
+}
+
+
+Trajectory::~Trajectory()
+{
+}
+
+
+int
+Trajectory::numAtoms()
+{
+    return mNumAtoms;
+}
+
+
+bool
+Trajectory::next(float * coords)
+{
+    bool read = mFormat == DCD? nextDCD(coords): nextXTC(coords);
+    if (read)
+        mNumFrames++;
+    return read;
+}
+
+
+void
+Trajectory::corrupted()
+{
+    cerr << "\"" << mFileName << "\" is corrupted or truncated (after "
+         << mNumFrames << " frames)" << endl;
+    exit(0);
+}
+
+
+//- = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = -
+// DCD
+//- = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = -
+
+// An int in the byte order of the DCD file
+int
+Trajectory::readInt(const char * p)
+{
+    unsigned int x;
+    memcpy(&x, p, sizeof(x));
+    return mSwap? _swap(x): x;
+}
+
+
+/**
+ * The next Fortran record of the DCD file, which is framed by its length
+ * (in bytes) before and after it. Sets len to that length.
+ */
+const char *
+Trajectory::record(size_t& len)
+{
+    if (mEnd - mPos < 8)
+        corrupted();
+    len = (unsigned int) readInt(mPos);
+    if ((size_t) (mEnd - mPos - 8) < len
+        || readInt(mPos + 4 + len) != (int) len)
+        corrupted();
+    const char * data = mPos + 4;
+    mPos += len + 8;
+    return data;
+}
+
+
+/**
+ * Reads the header records: the control record ("CORD" and 20 ints), the
+ * title, the number of atoms, and if there are fixed atoms, the list of
+ * the other (free) atoms.
+ */
+void
+Trajectory::readDCDHeader()
+{
+    unsigned int marker;
+    memcpy(&marker, mPos, sizeof(marker));
+    mSwap = marker != DCD_HEADER_BYTES;
+
+    size_t len;
+    const char * header = record(len);
+    if (len != DCD_HEADER_BYTES)
+        corrupted();
+    int control[20];
+    for (int i=0; i < 20; i++)
+        control[i] = readInt(header + 4 + 4*i);
+    bool charmm = control[19] != 0; // X-PLOR files have no version
+    int numFixed = control[8];
+    mHasCell = charmm && control[10];
+    mHas4D = charmm && control[11];
+
+    record(len); // title
+    const char * atoms = record(len);
+    if (len != 4 || (mNumAtoms = readInt(atoms)) <= 0
+        || numFixed < 0 || numFixed >= mNumAtoms)
+        corrupted();
+
+    if (numFixed > 0)
+    {
+        const char * free = record(len);
+        if (len != 4*(size_t) (mNumAtoms - numFixed))
+            corrupted();
+        mFreeAtoms.resize(mNumAtoms - numFixed);
+        for (int i=0; i < mFreeAtoms.size(); i++)
+        {
+            mFreeAtoms[i] = readInt(free + 4*i) - 1; // 1-based
+            if (mFreeAtoms[i] < 0 || mFreeAtoms[i] >= mNumAtoms)
+                corrupted();
+        }
+    }
+}
+
+
+/**
+ * A frame is a record each for the x, y and z coordinates, possibly with a
+ * unit cell record before and a 4th dimension record after. With fixed
+ * atoms, only the first frame has all atoms, and later frames have only
+ * the free atoms.
+ */
+bool
+Trajectory::nextDCD(float * coords)
+{
+    if (mPos == mEnd)
+        return false;
+
+    size_t len;
+    if (mHasCell)
+        record(len);
+
+    bool all = mFreeAtoms.empty() || mNumFrames == 0;
+    int n = all? mNumAtoms: mFreeAtoms.size();
+    if (!all)
+        memcpy(coords, &mLast[0], 3*mNumAtoms*sizeof(float));
+    for (int k=0; k < 3; k++)
+    {
+        const char * values = record(len);
+        if (len != 4*(size_t) n)
+            corrupted();
+        for (int i=0; i < n; i++)
+        {
+            int x = readInt(values + 4*i);
+            memcpy(&coords[3*(all? i: mFreeAtoms[i]) + k], &x, sizeof(x));
+        }
+    }
+
+    if (mHas4D)
+        record(len);
+    if (all && !mFreeAtoms.empty()) // the fixed atoms stay where they are
+        mLast.assign(coords, coords + 3*mNumAtoms);
+    return true;
+}
+
+
+//- = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = -
+// XTC
+//
+// The compressed coordinates are integers (the coordinates multiplied by
+// the precision). The first atom, and every atom after a run of nearby
+// atoms, is stored within the bounding box in the fewest bits. Nearby
+// atoms are stored as small differences from the atom before, in a number
+// of bits that adapts from run to run. The bits are unpacked as the GROMACS
+// xdrfile library packs them.
+//- = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = - = -
+
+#define XTC_FIRST_IDX 9
+static const int _magicints[] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 8, 10, 12, 16, 20, 25, 32, 40, 50, 64,
+    80, 101, 128, 161, 203, 256, 322, 406, 512, 645, 812, 1024, 1290,
+    1625, 2048, 2580, 3250, 4096, 5060, 6501, 8192, 10321, 13003,
+    16384, 20642, 26007, 32768, 41285, 52015, 65536, 82570, 104031,
+    131072, 165140, 208063, 262144, 330280, 416127, 524287, 660561,
+    832255, 1048576, 1321122, 1664510, 2097152, 2642245, 3329021,
+    4194304, 5284491, 6658042, 8388607, 10568983, 13316085, 16777216
+};
+#define XTC_LAST_IDX ((int) (sizeof(_magicints) / sizeof(*_magicints)))
+
+
+/**
+ * The bits of a frame's compressed coordinates, read most significant
+ * first. Reading past the end gives zeros and sets overrun.
+ */
+struct _XTCBits
+{
+    const unsigned char * data;
+    size_t size;
+    size_t cnt;            // bytes consumed
+    unsigned int lastbits; // bits of lastbyte not yet consumed
+    unsigned int lastbyte;
+    bool overrun;
+
+    _XTCBits(const char * d, size_t s)
+    {
+        data = (const unsigned char *) d;
+        size = s;
+        cnt = lastbits = lastbyte = 0;
+        overrun = false;
+    }
+
+    unsigned int nextByte()
+    {
+        if (cnt < size)
+            return data[cnt++];
+        overrun = true;
+        return 0;
+    }
+
+    unsigned int receive(int nbits)
+    {
+        unsigned int mask = nbits < 32? (1u << nbits) - 1: ~0u;
+        unsigned int num = 0;
+        while (nbits >= 8)
+        {
+            lastbyte = (lastbyte << 8) | nextByte();
+            num |= (lastbyte >> lastbits) << (nbits - 8);
+            nbits -= 8;
+        }
+        if (nbits > 0)
+        {
+            if (lastbits < nbits)
+            {
+                lastbits += 8;
+                lastbyte = (lastbyte << 8) | nextByte();
+            }
+            lastbits -= nbits;
+            num |= (lastbyte >> lastbits) & ((1u << nbits) - 1);
+        }
+        return num & mask;
+    }
+
+    // Three ints, packed together as one number of nbits bits
+    void receiveInts(int nbits, const unsigned int sizes[3], int nums[3])
+    {
+        unsigned int bytes[32];
+        int numBytes = 0;
+        bytes[1] = bytes[2] = bytes[3] = 0;
+        for (; nbits > 8; nbits -= 8)
+            bytes[numBytes++] = receive(8);
+        if (nbits > 0)
+            bytes[numBytes++] = receive(nbits);
+        for (int i=2; i > 0; i--)
+        {
+            unsigned int num = 0;
+            for (int j=numBytes-1; j >= 0; j--)
+            {
+                num = (num << 8) | bytes[j];
+                bytes[j] = num / sizes[i];
+                num -= bytes[j] * sizes[i];
+            }
+            nums[i] = num;
+        }
+        nums[0] = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16)
+                  | (bytes[3] << 24);
+    }
+};
+
+
+// The number of bits needed for values below size
+static int
+_sizeofint(unsigned int size)
+{
+    unsigned int num = 1;
+    int bits = 0;
+    while (size >= num && bits < 32)
+    {
+        bits++;
+        num <<= 1;
+    }
+    return bits;
+}
+
+
+// The number of bits needed for three values packed together
+static int
+_sizeofints(const unsigned int sizes[3])
+{
+    unsigned int bytes[32];
+    int numBytes = 1;
+    bytes[0] = 1;
+    for (int i=0; i < 3; i++)
+    {
+        unsigned int tmp = 0;
+        int cnt;
+        for (cnt=0; cnt < numBytes; cnt++)
+        {
+            tmp = bytes[cnt] * sizes[i] + tmp;
+            bytes[cnt] = tmp & 0xff;
+            tmp >>= 8;
+        }
+        for (; tmp != 0; tmp >>= 8)
+            bytes[cnt++] = tmp & 0xff;
+        numBytes = cnt;
+    }
+    int bits = 0;
+    unsigned int num = 1;
+    numBytes--;
+    while (bytes[numBytes] >= num)
+    {
+        bits++;
+        num *= 2;
+    }
+    return bits + numBytes*8;
+}
+
+
+bool
+Trajectory::nextXTC(float * coords)
+{
+    if (mPos == mEnd)
+        return false;
+
+    const char * p = mPos;
+    if (mEnd - p < XTC_HEADER_BYTES || _xdr_int(p) != XTC_MAGIC
+        || _xdr_int(p + 4) != mNumAtoms
+        || _xdr_int(p + XTC_HEADER_BYTES - 4) != mNumAtoms)
+        corrupted();
+    p += XTC_HEADER_BYTES;
+
+    if (mNumAtoms <= 9) // too few to compress
+    {
+        if (mEnd - p < 12*mNumAtoms)
+            corrupted();
+        for (int i=0; i < 3*mNumAtoms; i++, p += 4)
+            coords[i] = 10*_xdr_float(p);
+        mPos = p;
+        return true;
+    }
+
+    // precision, minint[3], maxint[3], smallidx, and the number of bytes
+    if (mEnd - p < 36)
+        corrupted();
+    float precision = _xdr_float(p);
+    int minint[3], maxint[3];
+    unsigned int sizeint[3];
+    int bitsizeint[3];
+    for (int k=0; k < 3; k++)
+    {
+        minint[k] = _xdr_int(p + 4 + 4*k);
+        maxint[k] = _xdr_int(p + 16 + 4*k);
+        if (maxint[k] < minint[k])
+            corrupted();
+        sizeint[k] = (unsigned int) maxint[k] - minint[k] + 1;
+    }
+    int bitsize = 0; // 0 if the three are sent separately
+    if ((sizeint[0] | sizeint[1] | sizeint[2]) > 0xffffff)
+        for (int k=0; k < 3; k++)
+            bitsizeint[k] = _sizeofint(sizeint[k]);
+    else
+        bitsize = _sizeofints(sizeint);
+    int smallidx = _xdr_int(p + 28);
+    size_t numBytes = (unsigned int) _xdr_int(p + 32);
+    p += 36;
+    size_t padded = (numBytes + 3) & ~(size_t) 3;
+    if (!(precision > 0) || smallidx < XTC_FIRST_IDX
+        || smallidx >= XTC_LAST_IDX || (size_t) (mEnd - p) < padded)
+        corrupted();
+
+    _XTCBits bits(p, numBytes);
+    int smaller = _magicints[max(XTC_FIRST_IDX, smallidx - 1)] / 2;
+    int smallnum = _magicints[smallidx] / 2;
+    unsigned int sizesmall[3];
+    sizesmall[0] = sizesmall[1] = sizesmall[2] = _magicints[smallidx];
+
+    mInts.resize(3*mNumAtoms);
+    int * ints = &mInts[0];
+    int prevcoord[3];
+    int run = 0; // number of small ints (3 per atom), kept until changed
+    for (int i=0; i < mNumAtoms; )
+    {
+        int * thiscoord = ints + 3*i;
+        if (bitsize == 0)
+            for (int k=0; k < 3; k++)
+                thiscoord[k] = bits.receive(bitsizeint[k]);
+        else
+            bits.receiveInts(bitsize, sizeint, thiscoord);
+        i++;
+        for (int k=0; k < 3; k++)
+            prevcoord[k] = thiscoord[k] += minint[k];
+
+        int is_smaller = 0;
+        if (bits.receive(1))
+        {
+            run = bits.receive(5);
+            is_smaller = run % 3;
+            run -= is_smaller;
+            is_smaller--;
+        }
+        if (i + run/3 > mNumAtoms)
+            corrupted();
+
+        int * large = thiscoord;
+        for (int r=0; r < run; r += 3)
+        {
+            thiscoord += 3;
+            bits.receiveInts(smallidx, sizesmall, thiscoord);
+            i++;
+            for (int k=0; k < 3; k++)
+            {
+                thiscoord[k] += prevcoord[k] - smallnum;
+                if (r == 0) // the first two atoms are swapped (for water)
+                {
+                    int tmp = thiscoord[k];
+                    thiscoord[k] = prevcoord[k];
+                    prevcoord[k] = large[k] = tmp;
+                }
+                else
+                    prevcoord[k] = thiscoord[k];
+            }
+        }
+
+        smallidx += is_smaller;
+        if (smallidx < XTC_FIRST_IDX || smallidx >= XTC_LAST_IDX)
+            corrupted();
+        if (is_smaller < 0)
+        {
+            smallnum = smaller;
+            smaller = smallidx > XTC_FIRST_IDX?
+                      _magicints[smallidx - 1] / 2: 0;
+        }
+        else if (is_smaller > 0)
+        {
+            smaller = smallnum;
+            smallnum = _magicints[smallidx] / 2;
+        }
+        sizesmall[0] = sizesmall[1] = sizesmall[2] = _magicints[smallidx];
+    }
+    if (bits.overrun)
+        corrupted();
+
+    float scale = 1 / precision;
+    for (int i=0; i < 3*mNumAtoms; i++)
+        coords[i] = 10*(ints[i] * scale); // nm to Angstroms
+    mPos = p + padded;
+    return true;
+}
@@ -0,0 +1,92 @@
+/*
+ *  **************************************************************************
+ *  Copyright 2026 Shuai Cheng Li and Yen Kaow Ng
+ *  **************************************************************************
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  **************************************************************************
+ * 
+ */
+
+
+
+
+#ifndef _TRAJECTORY_
+#define _TRAJECTORY_
+
+#include <stddef.h>
+#include <vector>
+
+#include "MappedFile.h"
+
+using namespace std;
+
+
+enum TRAJECTORY_FORMAT { NOT_TRAJECTORY, DCD, XTC };
+
+// The format of a trajectory file, as told by its header
+TRAJECTORY_FORMAT trajectory_format(const char * data, size_t size);
+
+
+/**
+ * The frames of a molecular dynamics trajectory, read one at a time from a
+ * DCD (CHARMM, NAMD, X-PLOR; either byte order) or XTC (GROMACS) file.
+ * The file is memory-mapped, so a frame is decoded straight from the page
+ * cache and nothing else of the file is held in memory.
+ *
+ * The coordinates of all atoms are given in the order of the atoms in the
+ * topology, and in Angstroms (XTC coordinates, in nm, are scaled by 10).
+ *
+ * Errors, such as a file that ends in the middle of a frame, end the
+ * program with a message naming the file.
+ */
+class Trajectory
+{
+public:
+    Trajectory(const char * filename);
+    ~Trajectory();
+    int numAtoms();
+
+    // Read the next frame into coords (of 3*numAtoms()). False at the end
+    bool next(float * coords);
+
+private:
+    const char * mFileName;
+    MappedFile mFile;
+    TRAJECTORY_FORMAT mFormat;
+    const char * mPos;      // the next frame
+    const char * mEnd;
+    int mNumAtoms;
+    int mNumFrames;         // read so far
+
+    // for DCD
+    bool mSwap;             // the file has the other byte order
+    bool mHasCell;          // each frame begins with a unit cell record
+    bool mHas4D;            // each frame ends with a 4th dimension record
+    vector<int> mFreeAtoms; // with fixed atoms, the atoms in later frames
+    vector<float> mLast;    // with fixed atoms, the previous frame
+
+    // for XTC
+    vector<int> mInts;      // the decompressed coordinates
+
+    int readInt(const char * p);
+    const char * record(size_t& len);
+    void readDCDHeader();
+    bool nextDCD(float * coords);
+    bool nextXTC(float * coords);
+    void corrupted();
+};
+
+#endif
@@ -23,6 +23,8 @@
 
 #include <math.h>
 #include <stdlib.h>
+#include <sstream>
+#include <iomanip>
 #include "InitCluster.h"
 #include "SimpPDB.h"
 
@@ -31,12 +33,36 @@ void
 usage(char * progname)
 {
   cerr << "Usage: " << progname
-  << " [-n] [-o] [-r #1,#2] [-c XYZ] [-a CCC] [-m] [-t s] pdb_list [x]"
-  << endl << endl
+  << " [-n] [-o] [-r #1,#2] [-c XYZ] [-a CCC] [-m] [-t s]" << endl
+  << "         [--mem-limit M] [--scratch DIR] [--pack P] [--threads N]"
+  << endl
+  << "         [--top T] [--keep K] [--score C] [--collapse]"
+  << " [--collapse-rmsd E]" << endl
+  << "         [--select NAME:#1,#2[:XYZ]]... [--cache DIR]" << endl
+  << "         [--checkpoint F [--resume]] pdb_list [x]" << endl << endl
   << "  pdb_list is a text file which specifies the decoys. Each line in"
   << " pdb_list is" << endl
-  << "    a path (relative to the working directory) to a decoy's PDB file."
-  << endl << endl
+  << "    a path (relative to the working directory) to a decoy's PDB file"
+  << endl
+  << "    (or mmCIF file)." << endl
+  << "    pdb_list can also be a (text or binary) silent file, a pack file"
+  << endl
+  << "    (see --pack), or a PDB file, in which case every model in the file"
+  << endl
+  << "    is a decoy." << endl
+  << "    pdb_list can also be a DCD or XTC trajectory (see --top), in which"
+  << endl
+  << "    case every frame is a decoy." << endl
+  << "    pdb_list can also be a tar archive (which may be compressed) of"
+  << " decoy files," << endl
+  << "    each a decoy named by its path in the archive." << endl
+  << "    pdb_list can also be -, to read decoys from the standard input as"
+  << endl
+  << "    they are generated: PDB models one after another, or binary"
+  << " records" << endl
+  << "    (see DecoyStream.h). The threshold range is estimated as soon as"
+  << endl
+  << "    enough decoys have arrived." << endl << endl
   << "  -n (optional) disables the filtering of outlier decoys."
   << endl << endl
   << "  -o (optional) output all clusters instead of only the top three."
@@ -62,6 +88,12 @@ usage(char * progname)
   << "                WARNING: When more than one atom names are specified, "
   << endl
   << "                multiple atoms from the same residue will be allowed."
+  << endl
+  << "                Only N, CA, C, and O can be used in binary silent files."
+  << endl << endl
+  << "  -m (optional) specifies that the PDB files in pdb_list hold multiple"
+  << endl
+  << "                models, each of which is a decoy named file#model."
   << endl << endl
   << "  -t (optional) specifies the threshold finding strategy." << endl
   << "    s is one of p, f, a, R, r. (default strategy: p)" << endl
@@ -78,6 +110,87 @@ usage(char * progname)
   << endl
   << "     r: same as R, but with a sampled decoy set rather than the full set."
   << endl << endl
+  << "  --mem-limit (optional) limits the memory used to M bytes (suffix K, M,"
+  << endl
+  << "                or G for kilo-, mega-, or gigabytes), e.g. M=4G."
+  << endl
+  << "                The decoys are preloaded and MATRIX mode is used only if"
+  << endl
+  << "                they fit. By default, M is 3/4 of the physical memory."
+  << endl
+  << "                Decoys which do not fit are read once into a scratch"
+  << endl
+  << "                file. If even the neighbor lists do not fit, they are"
+  << endl
+  << "                kept in scratch files on disk."
+  << endl << endl
+  << "  --scratch (optional) puts the scratch files in directory DIR instead"
+  << endl
+  << "                of $TMPDIR or /tmp." << endl << endl
+  << "  --pack (optional) only writes the decoys, with the atoms selected by"
+  << endl
+  << "                -r, -c, and -a, into the pack file P. Clustering P"
+  << endl
+  << "                instead of pdb_list skips the loading of the decoys."
+  << endl
+  << "                P must be clustered with the same -r, -c, and -a."
+  << endl << endl
+  << "  --threads (optional) loads the decoys on N threads. By default, as"
+  << endl
+  << "                many threads as there are processors are used."
+  << endl << endl
+  << "  --top (required for a trajectory) specifies the PDB file T of the"
+  << endl
+  << "                trajectory's atoms, in which -r, -c, and -a select the"
+  << endl
+  << "                atoms to use." << endl << endl
+  << "  --keep (optional, silent files only) keeps only the K decoys of"
+  << " lowest" << endl
+  << "                score, or the K percent of the decoys of lowest score"
+  << endl
+  << "                if K ends in %, e.g. K=10%. The other decoys are"
+  << " skipped" << endl
+  << "                while the silent file is read." << endl << endl
+  << "  --score (optional) specifies the column C of the SCORE: lines which"
+  << endl
+  << "                --keep goes by. By default, C=score." << endl << endl
+  << "  --collapse (optional) clusters each set of decoys with the same"
+  << endl
+  << "                coordinates as one decoy, counted as many times as"
+  << endl
+  << "                there are decoys in the set." << endl << endl
+  << "  --collapse-rmsd (optional) collapses, as --collapse, also the"
+  << " decoys within" << endl
+  << "                RMSD E of a decoy that is kept." << endl << endl
+  << "  --select (optional, may be repeated) clusters, in turn, the atoms"
+  << " which" << endl
+  << "                -r #1,#2 and -c XYZ would select, as selection NAME."
+  << endl
+  << "                #1,#2 may be left out for the range of -r, and :XYZ"
+  << endl
+  << "                for the chains of -c, e.g. loop:40,60 or iface::AB."
+  << endl
+  << "                The decoys (PDB or mmCIF files) are loaded only once,"
+  << endl
+  << "                with the atoms of all the selections." << endl << endl
+  << "  --cache (optional) keeps the threshold estimated and the clusters"
+  << " found in" << endl
+  << "                the existing directory DIR, and takes them from there"
+  << " when" << endl
+  << "                the same decoys are clustered with the same options."
+  << endl << endl
+  << "  --checkpoint (optional) keeps the state of the clustering in the file"
+  << " F as" << endl
+  << "                it is reached: the threshold, the decoys kept by"
+  << " filtering," << endl
+  << "                and what is found before and while finding the"
+  << " neighbors" << endl
+  << "                of the decoys (with --select, in F.NAME for each"
+  << " selection)." << endl << endl
+  << "  --resume (optional) continues a clustering which was stopped from"
+  << " where" << endl
+  << "                its checkpoint F was. F must be of the same input and"
+  << " options." << endl << endl
   << "  x (optional) specifies a floating point number" << endl
   << "    x is used according to the threshold strategy specified."
   << " (x is ignored"
@@ -87,6 +200,193 @@ usage(char * progname)
   << endl;
 }
 
+/**
+ * Parse a size such as "4G" or "512M" into bytes. Returns 0 if invalid.
+ */
+static double
+parse_size(char * spec)
+{
+    char * unit;
+    double size = strtod(spec, &unit);
+    switch (toupper(*unit))
+    {
+        case 'T': size *= 1024;
+        case 'G': size *= 1024;
+        case 'M': size *= 1024;
+        case 'K': size *= 1024; unit++;
+        default: break;
+    }
+    if (*unit != '\0' && toupper(*unit) != 'B')
+        return 0;
+    return size > 0? size: 0;
+}
+
+/**
+ * Parse a residue range as -r gives it ("start", "start,", ",end" or
+ * "start,end") into start and end. Returns false if invalid.
+ */
+static bool
+parse_range(char * spec, int * start, int * end)
+{
+    char * segment_spec = strdup(spec);
+    char * p = segment_spec;
+    bool valid;
+    for (; *p && *p != ','; p++)
+        ;
+    if (*p == '\0') // then no ',' found. spec is "start"
+    {
+        *start = atoi(segment_spec);
+        *end = LONGEST_CHAIN;
+        valid = *start > 0;
+    }
+    else if (p == segment_spec) // spec is ",end", or ","
+    {
+        *end = atoi(p+1);
+        *start = 0;
+        valid = *end > 0;
+    }
+    else // spec must be "start," or "start,end"
+    {
+        *end = (*(p+1)=='\0')?LONGEST_CHAIN:atoi(p+1);
+        *p = '\0';
+        *start = atoi(segment_spec);
+        valid = *end > 0 && *start > 0 && *end >= *start;
+    }
+    free(segment_spec);
+    return valid;
+}
+
+/**
+ * Parse the selections given as NAME:#1,#2[:XYZ] into SimPDB::selections,
+ * and set the selection which the decoys are loaded with to their union.
+ * A selection without a range or chains has those of -r and -c.
+ */
+static bool
+parse_selections(vector<char *>& specs)
+{
+    // those of -r and -c, before they are replaced by the union
+    int s_residue = SimPDB::s_residue;
+    int e_residue = SimPDB::e_residue;
+    char * defaultChains = SimPDB::chains;
+
+    bool allChains = false;
+    string chains;
+    int s_union = 0, e_union = 0;
+    for (int i=0; i < specs.size(); i++)
+    {
+        NamedSelection selection;
+        selection.name = strdup(specs[i]);
+        selection.s_residue = s_residue;
+        selection.e_residue = e_residue;
+        selection.chains = defaultChains;
+        char * range = strchr(selection.name, ':');
+        if (range == NULL || range == selection.name)
+            return false;
+        *range++ = '\0';
+        char * chain = strchr(range, ':');
+        if (chain)
+        {
+            *chain++ = '\0';
+            selection.chains = chain;
+        }
+        if (*range && !parse_range(range, &selection.s_residue,
+                                   &selection.e_residue))
+            return false;
+        SimPDB::selections.push_back(selection);
+
+        allChains = allChains || strchr(selection.chains, '*');
+        for (char * c = selection.chains; *c; c++)
+            if (chains.find(*c) == string::npos)
+                chains += *c;
+        if (i == 0 || selection.s_residue < s_union)
+            s_union = selection.s_residue;
+        if (i == 0 || selection.e_residue > e_union)
+            e_union = selection.e_residue;
+    }
+    SimPDB::s_residue = s_union;
+    SimPDB::e_residue = e_union;
+    SimPDB::chains = strdup(allChains? "*": chains.c_str());
+    return true;
+}
+
+/**
+ * Cluster the decoys in filename, and show the clusters
+ */
+static void
+cluster(Clustering * ic, char * filename, float threshold)
+{
+    if (!ic->initialize(filename, threshold)) // shown from the cache
+        return;
+    ic->cluster();
+
+    // what is said of the clusters, which is cached with them
+    ostringstream verdict;
+    verdict.setf(ios::fixed);
+    verdict << setprecision(5);
+
+    float acceptMargin = 0.15;
+    if (ic->bestClusMargin < acceptMargin)
+    {
+        verdict << "Best cluster larger than 2nd best cluster by only "
+                << (ic->bestClusMargin*100) << "% (<"
+                << (acceptMargin*100) << "%)" << endl
+                << "Two possible clusters could be present." << endl;
+        cout << verdict.str() << "Starting refined clustering..." << endl;
+
+        // create new PDBs and Names out of the elements in the best two
+        // clusters
+
+        // first get the lists
+        vector<AdjacentList *> * finalClusters = ic->mFinalClusters;
+        vector<char *>* Names = new vector<char *>(0);
+        vector<int>* IDs = new vector<int>(0);
+        vector<Stru *>* PDBs = new vector<Stru *>(0);
+
+        // then add elements into them
+        AdjacentList* clus;
+        clus = (*finalClusters)[1];
+        ic->getPDBs(Names, IDs, PDBs, clus->neigh, clus->mNumNeigh);
+        clus = (*finalClusters)[0];
+        ic->getPDBs(Names, IDs, PDBs, clus->neigh, clus->mNumNeigh);
+
+        // Refined Clustering
+        float minDist, maxDist, mostFreqDist, xPercentileDist;
+        int numDecoys = Names->size() > 2*RANDOM_DECOY_SIZE_FOR_THRESHOLD?
+                         RANDOM_DECOY_SIZE_FOR_THRESHOLD: Names->size()/2;
+        ic->estimateDist(IDs,
+                         NUM_TRIALS_FOR_THRESHOLD,
+                         numDecoys,
+                         0.5,
+                         &minDist,
+                         &maxDist,
+                         &mostFreqDist,
+                         &xPercentileDist);
+        ic->reinitialize(Names, IDs, PDBs, xPercentileDist);
+        ic->cluster();
+
+        if (ic->bestClusMargin < acceptMargin)
+        {
+            cout << "MORE THAN ONE BEST DECOYS DETECTED!" << endl;
+            verdict << "MORE THAN ONE BEST DECOYS DETECTED!" << endl;
+        }
+    }
+
+    ostringstream clusters;
+    if (Clustering::OUTPUT_ALL)
+    {
+        clusters << "Showing all clusters:" << endl;
+        ic->showClusters(ic->mNumPDB, clusters);
+    }
+    else
+    {
+        clusters << "Showing at most three largest clusters:" << endl;
+        ic->showClusters(3, clusters);
+    }
+    cout << clusters.str();
+    if (ic->mCache)
+        ic->mCache->setClusters(verdict.str() + clusters.str());
+}
+
 int main(int argc, char** argv)
 {
     if (argc < 2)
@@ -97,6 +397,9 @@ int main(int argc, char** argv)
 
     Clustering * ic = new Clustering();
     bool strategy_specified = false;
+    bool score_specified = false;
+    char * pack_filename = NULL;
+    vector<char *> selection_specs;
     int i;
 
     //SimPDB::e_residue = LONGEST_CHAIN;
@@ -105,10 +408,134 @@ int main(int argc, char** argv)
 
     for (i = 1; i < argc; i++)
     {
-        if ('-' != *argv[i])
+        if ('-' != *argv[i] || !strcmp(argv[i], "-")) // - is the input
             break;
         switch (argv[i][1])
         {
+            case '-': // long options
+                if (!strcmp(argv[i], "--mem-limit"))
+                {
+                    i++;
+                    if (i == argc || !(Clustering::MEM_LIMIT=parse_size(argv[i])))
+                    {
+                        usage(argv[0]);
+                        exit(0);
+                    }
+                }
+                else if (!strcmp(argv[i], "--scratch"))
+                {
+                    i++;
+                    if (i == argc)
+                    {
+                        usage(argv[0]);
+                        exit(0);
+                    }
+                    DiskAdjacency::scratchDir = argv[i];
+                }
+                else if (!strcmp(argv[i], "--pack"))
+                {
+                    i++;
+                    if (i == argc)
+                    {
+                        usage(argv[0]);
+                        exit(0);
+                    }
+                    pack_filename = argv[i];
+                }
+                else if (!strcmp(argv[i], "--threads"))
+                {
+                    i++;
+                    if (i == argc || (PreloadedPDB::NUM_THREADS=atoi(argv[i])) <= 0)
+                    {
+                        usage(argv[0]);
+                        exit(0);
+                    }
+                }
+                else if (!strcmp(argv[i], "--top"))
+                {
+                    i++;
+                    if (i == argc)
+                    {
+                        usage(argv[0]);
+                        exit(0);
+                    }
+                    PreloadedPDB::topology = argv[i];
+                }
+                else if (!strcmp(argv[i], "--score"))
+                {
+                    i++;
+                    if (i == argc)
+                    {
+                        usage(argv[0]);
+                        exit(0);
+                    }
+                    PreloadedPDB::scoreColumn = argv[i];
+                    score_specified = true;
+                }
+                else if (!strcmp(argv[i], "--keep"))
+                {
+                    i++;
+                    char * end;
+                    if (i == argc
+                        || (PreloadedPDB::keepDecoys=strtod(argv[i], &end)) <= 0
+                        || (*end && strcmp(end, "%")))
+                    {
+                        usage(argv[0]);
+                        exit(0);
+                    }
+                    PreloadedPDB::keepPercent = *end == '%';
+                }
+                else if (!strcmp(argv[i], "--select"))
+                {
+                    i++;
+                    if (i == argc)
+                    {
+                        usage(argv[0]);
+                        exit(0);
+                    }
+                    selection_specs.push_back(argv[i]);
+                }
+                else if (!strcmp(argv[i], "--cache"))
+                {
+                    i++;
+                    if (i == argc)
+                    {
+                        usage(argv[0]);
+                        exit(0);
+                    }
+                    ResultCache::directory = argv[i];
+                }
+                else if (!strcmp(argv[i], "--checkpoint"))
+                {
+                    i++;
+                    if (i == argc)
+                    {
+                        usage(argv[0]);
+                        exit(0);
+                    }
+                    Checkpoint::fileName = argv[i];
+                }
+                else if (!strcmp(argv[i], "--resume"))
+                    Checkpoint::resume = true;
+                else if (!strcmp(argv[i], "--collapse"))
+                    Clustering::COLLAPSE = true;
+                else if (!strcmp(argv[i], "--collapse-rmsd"))
+                {
+                    i++;
+                    if (i == argc
+                        || (Clustering::COLLAPSE_RMSD=atof(argv[i])) <= 0)
+                    {
+                        usage(argv[0]);
+                        exit(0);
+                    }
+                    Clustering::COLLAPSE = true;
+                }
+                else
+                {
+                    usage(argv[0]);
+                    exit(0);
+                }
+                break;
             case 'd': // this feature is not revealed in usage()
                 SimPDB::preloadPDB = false;
                 break;
@@ -138,46 +565,12 @@ int main(int argc, char** argv)
                     usage(argv[0]);
                     exit(0);
                 }
+                if (!parse_range(argv[i], &SimPDB::s_residue,
+                                 &SimPDB::e_residue))
                 {
-                char * segment_spec = strdup(argv[i]);
-                char * p = segment_spec;
-                for (; *p && *p != ','; p++)
-                    ;
-                if (*p == '\0') // then no ',' found. spec is "start"
-                {
-                    SimPDB::s_residue = atoi(segment_spec);
-                    SimPDB::e_residue = LONGEST_CHAIN;
-                    if (SimPDB::s_residue <= 0) // invalid spec
-                    {
-                        cout << "Invalid -r specification" << endl << endl;
-                        usage(argv[0]);
-                        exit(0);
-                    }
-                }
-                else if (p == segment_spec) // spec is ",end", or ","
-                {
-                    SimPDB::e_residue = atoi(p+1);
-                    SimPDB::s_residue = 0;
-                    if (SimPDB::e_residue <= 0)
-                    {
-                        cout << "Invalid -r specification" << endl << endl;
-                        usage(argv[0]);
-                        exit(0);
-                    }
-                }
-                else // spec must be "start," or "start,end"
-                {
-                    SimPDB::e_residue = (*(p+1)=='\0')?LONGEST_CHAIN:atoi(p+1);
-                    *p = '\0';
-                    SimPDB::s_residue = atoi(segment_spec);
-                    if (SimPDB::e_residue <= 0 || SimPDB::s_residue <= 0
-                        || SimPDB::e_residue < SimPDB::s_residue)
-                    {
-                        cout << "Invalid -r specification" << endl << endl;
-                        usage(argv[0]);
-                        exit(0);
-                    }
-                }
+                    cout << "Invalid -r specification" << endl << endl;
+                    usage(argv[0]);
+                    exit(0);
                 }
                 cout << "Using C-alphas #" << SimPDB::s_residue << "-";
                 if (SimPDB::e_residue == LONGEST_CHAIN)
@@ -185,6 +578,9 @@ int main(int argc, char** argv)
                 else
                     cout << "#" << SimPDB::e_residue << endl;
                 break;
+            case 'm':
+                SimPDB::multiModel = true;
+                break;
             case 'n':
                 Clustering::FILTER_MODE = false;
                 break;
@@ -227,7 +623,7 @@ int main(int argc, char** argv)
         }
     }
 
-    if (i == argc)
+    if (i == argc || (Checkpoint::resume && !Checkpoint::fileName))
     {
         usage(argv[0]);
         exit(0);
@@ -235,6 +631,42 @@ int main(int argc, char** argv)
 
     char * filename = strdup(argv[i]);
 
+    // Only a silent file has scores to filter its decoys by
+    if ((PreloadedPDB::keepDecoys > 0 || score_specified)
+        && filetype(filename) != SILENT_FILE)
+    {
+        cout << "WARNING: --keep and --score apply only to silent files;"
+             << " all the decoys of \"" << filename << "\" are used" << endl;
+        PreloadedPDB::keepDecoys = 0;
+    }
+
+    if (pack_filename) // only convert the decoys into a pack file
+    {
+        PreloadedPDB * pdbs = new PreloadedPDB();
+        switch (filetype(filename))
+        {
+            case SILENT_FILE: pdbs->loadSilentFile(filename); break;
+            case PDB_LIST: pdbs->loadPDBFromList(filename); break;
+            case PDB_FILE: pdbs->loadPDBFile(filename); break;
+            case TRAJECTORY_FILE: pdbs->loadTrajectory(filename); break;
+            case TAR_FILE: pdbs->loadTarFile(filename); break;
+            case DECOY_STREAM: pdbs->loadStream(0); break;
+            case PACK_FILE:
+                cerr << "\"" << filename << "\" is already a pack file" << endl;
+                exit(0);
+            default: cerr << "Unknown file type" << endl; exit(0);
+        }
+        pdbs->writePackFile(pack_filename);
+        exit(0);
+    }
+
+    if (!selection_specs.empty() && !parse_selections(selection_specs))
+    {
+        cout << "Invalid --select specification" << endl << endl;
+        usage(argv[0]);
+        exit(0);
+    }
+
     float threshold = -1;
     i++;
     if (i == argc-1)
@@ -268,61 +700,25 @@ int main(int argc, char** argv)
     exit(0);
     */
 
-    ic->initialize(filename, threshold);
-    ic->cluster();
-
-    float acceptMargin = 0.15;
-    if (ic->bestClusMargin < acceptMargin)
+    if (SimPDB::selections.empty())
     {
-        cout << "Best cluster larger than 2nd best cluster by only "
-             << (ic->bestClusMargin*100) << "% (<"
-             << (acceptMargin*100) << "%)" << endl
-             << "Two possible clusters could be present." << endl
-             << "Starting refined clustering..." << endl;
-
-        // create new PDBs and Names out of the elements in the best two
-        // clusters
-
-        // first get the lists
-        vector<AdjacentList *> * finalClusters = ic->mFinalClusters;
-        vector<char *>* Names = new vector<char *>(0);
-        vector<Stru *>* PDBs = new vector<Stru *>(0);
-
-        // then add elements into them
-        AdjacentList* clus;
-        clus = (*finalClusters)[1];
-        ic->getPDBs(Names, PDBs, clus->neigh, clus->mNumNeigh);
-        clus = (*finalClusters)[0];
-        ic->getPDBs(Names, PDBs, clus->neigh, clus->mNumNeigh);
-
-        // Refined Clustering
-        float minDist, maxDist, mostFreqDist, xPercentileDist;
-        int numDecoys = Names->size() > 2*RANDOM_DECOY_SIZE_FOR_THRESHOLD?
-                         RANDOM_DECOY_SIZE_FOR_THRESHOLD: Names->size()/2;
-        ic->estimateDist(Names,
-                         NUM_TRIALS_FOR_THRESHOLD,
-                         numDecoys,
-                         0.5,
-                         &minDist,
-                         &maxDist,
-                         &mostFreqDist,
-                         &xPercentileDist);
-        ic->reinitialize(Names, PDBs, xPercentileDist);
-        ic->cluster();
-
-        if (ic->bestClusMargin < acceptMargin)
-            cout << "MORE THAN ONE BEST DECOYS DETECTED!" << endl;
-    }
-
-    if (Clustering::OUTPUT_ALL)
-    {
-        cout << "Showing all clusters:" << endl;
-        ic->showClusters(ic->mNumPDB);
+        cluster(ic, filename, threshold);
+        return 0;
     }
-    else
+    for (int n=0; n < SimPDB::selections.size(); n++)
     {
-        cout << "Showing at most three largest clusters:" << endl;
-        ic->showClusters(3);
+        NamedSelection& selection = SimPDB::selections[n];
+        cout << endl << "Clustering selection \"" << selection.name
+             << "\" (-r " << selection.s_residue << ","
+             << selection.e_residue << " -c \"" << selection.chains << "\")"
+             << endl;
+        if (n > 0)
+        {
+            delete ic;
+            ic = new Clustering();
+        }
+        ic->mSelection = &selection;
+        cluster(ic, filename, threshold);
     }
 }
 